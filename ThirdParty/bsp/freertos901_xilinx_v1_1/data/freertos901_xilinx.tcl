@@ -546,6 +546,7 @@ proc generate {os_handle} {
 	puts $config_file "#define INCLUDE_eTaskGetState                1"
 	puts $config_file "#define INCLUDE_xTimerPendFunctionCall       1"
 	puts $config_file "#define INCLUDE_pcTaskGetTaskName            1"
+	puts $config_file "#define INCLUDE_xTaskGetSchedulerState       1"
 
 	############################################################################
 	## Add constants specific to the psu_cortexr5
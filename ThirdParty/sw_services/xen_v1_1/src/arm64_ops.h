@@ -43,6 +43,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define _ARM64_OPS_H_
 #include <stdint.h>
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 #define BUG() while(1){asm volatile (".word 0xe7f000f0\n");} /* Undefined instruction; will call our fault handler. */
 #define ASSERT(x)                                              \
 do {                                                           \
@@ -57,7 +60,13 @@ do {                                                           \
 
 #define BUG_ON(x) ASSERT(!(x))
 
-#define smp_processor_id() 0
+// Xen numbers a guest's vCPUs by virtual affinity: the low four bits of the
+// vCPU ID are in Aff0 and the rest in Aff1.
+static inline unsigned int smp_processor_id(void) {
+    uint64_t mpidr;
+    __asm volatile ( "MRS %0, MPIDR_EL1" : "=r" (mpidr) );
+    return (mpidr & 0xf) | (((mpidr >> 8) & 0xff) << 4);
+}
 
 #define barrier() __asm__ __volatile__("": : :"memory")
 
@@ -93,6 +102,34 @@ static inline int irqs_disabled(void) {
     return x & 0x80;
 }
 
+// Set by the FreeRTOS port while an interrupt is being handled
+extern uint64_t ullPortInterruptNesting;
+
+// Whether the caller is an interrupt handler
+static inline int xen_in_isr(void) {
+    return ullPortInterruptNesting > 0;
+}
+
+// Whether the caller is a task that may block, which needs the scheduler running
+static inline int xen_can_block(void) {
+    return !xen_in_isr() && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING;
+}
+
+// Reads the virtual counter, ordered after earlier instructions
+static inline uint64_t read_cntvct(void) {
+    uint64_t val;
+    __asm volatile ( "ISB SY" );
+    __asm volatile ( "MRS %0, CNTVCT_EL0" : "=r" (val) );
+    return val;
+}
+
+// Reads the frequency of the system counter, in Hz
+static inline uint64_t read_cntfrq(void) {
+    uint64_t val;
+    __asm volatile ( "MRS %0, CNTFRQ_EL0" : "=r" (val) );
+    return val;
+}
+
 #define dsb(scope)      asm volatile("dsb " #scope : : : "memory")
 
 /* We probably only need "dmb" here, but we'll start by being paranoid. */
@@ -178,12 +215,13 @@ static __inline__ unsigned long __ffs(unsigned long word)
 
 /********************* common arm32 and arm64  ****************************/
 
-/* If *ptr == old, then store new there (and return new).
- * Otherwise, return the old value.
+/* If *ptr == old, then store new there. Returns the value *ptr held before,
+ * which equals old if the store happened.
  * Atomic. */
 #define synch_cmpxchg(ptr, old, new) \
 ({ __typeof__(*ptr) stored = old; \
-   __atomic_compare_exchange_n(ptr, &stored, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? new : old; \
+   __atomic_compare_exchange_n(ptr, &stored, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+   stored; \
 })
 
 /* As test_and_clear_bit, but using __ATOMIC_SEQ_CST */
@@ -26,5 +26,7 @@ int HYPERVISOR_hvm_op(int cmd, void* param);
 int HYPERVISOR_memory_op(int cmd, void* param);
 int HYPERVISOR_event_channel_op(int cmd, void* param);
 int HYPERVISOR_grant_table_op(unsigned int cmd, void *uop, unsigned int count);
+int HYPERVISOR_vcpu_op(int cmd, int vcpuid, void *extra_args);
+int HYPERVISOR_sched_op(int cmd, void *arg);
 
 #endif  /* __HYPERCALL_ARM_H__ */
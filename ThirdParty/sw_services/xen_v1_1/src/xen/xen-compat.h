@@ -28,7 +28,7 @@
 #define __XEN_PUBLIC_XEN_COMPAT_H__
 
 /* Xen interface version to use */
-#define __XEN_INTERFACE_VERSION__ 0x00030205
+#define __XEN_INTERFACE_VERSION__ 0x0003020a
 
 #define __XEN_LATEST_INTERFACE_VERSION__ 0x00040600
 
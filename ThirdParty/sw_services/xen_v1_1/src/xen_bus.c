@@ -19,87 +19,292 @@
 #include "xen_bus.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "task.h"
+
+#include "arm64_ops.h"
 
 
 /******** Definitions *********************************************************/
+/* How often a backend state without a watch is read again */
+#define OTHEREND_POLL_MS    10
 
 
 /******** Function Prototypes *************************************************/
+static int  read_otherend_state(struct xenbus_device * dev);
+static int  collect_key(int handle, const char * dir, const char * node,
+    char * buf, size_t buf_len);
+static void otherend_changed(void * arg, const char * path, const char * token);
 
 
 /******** Module Variables ****************************************************/
 
 
 /******** Private Functions ***************************************************/
+/* Reads the backend state past the read cache, which may not have seen the
+ * change yet when this runs in the watch task */
+static int read_otherend_state(struct xenbus_device * dev)
+{
+    char * data;
+    int    state = -1;
+
+    data = xenstore_read_uncached(XBT_NIL, dev->otherend, "state", NULL);
+    if(data != NULL)
+    {
+        sscanf(data, "%d", &state);
+        free(data);
+    }
+
+    return state;
+}
+
+/* Copies the value of a read sent with xenstore_read_async() into buf. If
+ * the read could not be sent (handle < 0), reads it now instead. */
+static int collect_key(int handle, const char * dir, const char * node,
+    char * buf, size_t buf_len)
+{
+    char * data = NULL;
+    size_t len;
+    int    retval = -1;
+
+    if(handle < 0)
+    {
+        return xenstore_read_buf(XBT_NIL, dir, node, buf, buf_len, NULL);
+    }
+
+    if(xenstore_wait(handle, &data, &len, XENSTORE_WAIT_FOREVER) == 0 &&
+       len < buf_len)
+    {
+        memcpy(buf, data, len);
+        buf[len] = '\0';
+        retval = 0;
+    }
+    free(data);
+
+    return retval;
+}
+
+/* Watch callback for the backend's state node */
+static void otherend_changed(void * arg, const char * path, const char * token)
+{
+    struct xenbus_device * dev = arg;
+    int                    state;
+
+    state = read_otherend_state(dev);
+    if(state >= 0 && state != dev->otherend_state)
+    {
+        dev->otherend_state = (XenbusState)state;
+        xSemaphoreGive(dev->otherend_changed);
+    }
+}
 
 
 /******** Public Functions ****************************************************/
+/*
+ * Sets the state node under path. Outside a transaction this is a single
+ * write. Within one, the state is read first and only written if it
+ * changes, so the transaction stays free of needless writes.
+ */
 int xenbus_switch_state(xenbus_transaction_t trans_id, const char* path,
     XenbusState state)
 {
-    int   again;
-    int   xbt_flag = 0;
-    char* strvalue = NULL;
-    XenbusState current_state;
+    int current_state;
 
-    again = 1;
-    while(again)
+    if(trans_id == XBT_NIL)
     {
-        /* Start transaction if one was not provided */
-        if(trans_id == XBT_NIL)
-        {
-            if(xenstore_transaction_start(&trans_id) != 0)
-            {
-                goto error;
-            }
+        return (xenstore_printf(XBT_NIL, path, "state", "%d", state) < 0) ? -1 : 0;
+    }
 
-            xbt_flag = 1;
+    current_state = xenstore_read_int(trans_id, path, "state");
+    if(current_state < 0)
+    {
+        return -1;
+    }
+
+    if(current_state != state)
+    {
+        if(xenstore_printf(trans_id, path, "state", "%d", state) < 0)
+        {
+            return -1;
         }
+    }
+
+    return 0;
+}
+
+/*
+ * Sets up a frontend device at nodename (e.g. "device/vgpio/0"): finds its
+ * backend and switches the device to Initialising. The backend state is
+ * followed with a watch if the xenstore tasks run, else read on demand.
+ */
+int xenbus_device_init(struct xenbus_device * dev, const char * nodename)
+{
+    char otherend_id[12];
+    char path[XENBUS_PATH_MAX];
+    int  handles[2];
+    int  err;
+
+    memset(dev, 0, sizeof(*dev));
+    dev->otherend_watch = -1;
+
+    if(strlen(nodename) >= sizeof(dev->nodename))
+    {
+        return -1;
+    }
+    strcpy(dev->nodename, nodename);
+
+    /* Both reads in flight at once. No transaction is needed, as the
+     * backend of a device does not move. */
+    handles[0] = xenstore_read_async(XBT_NIL, dev->nodename, "backend", NULL, NULL);
+    handles[1] = xenstore_read_async(XBT_NIL, dev->nodename, "backend-id", NULL, NULL);
+
+    err  = collect_key(handles[0], dev->nodename, "backend",
+        dev->otherend, sizeof(dev->otherend));
+    err |= collect_key(handles[1], dev->nodename, "backend-id",
+        otherend_id, sizeof(otherend_id));
+    if(err != 0)
+    {
+        return -1;
+    }
+    dev->otherend_id = (domid_t)strtoul(otherend_id, NULL, 10);
+
+    dev->otherend_changed = xSemaphoreCreateBinary();
+    if(dev->otherend_changed == NULL)
+    {
+        return -1;
+    }
 
-        /* Read device current state.  strvalue must be freed after use */
-        strvalue = xenstore_read(trans_id, path, "state", NULL);
-        if(strvalue == NULL)
+    if(xenbus_switch_state(XBT_NIL, dev->nodename, XenbusStateInitialising) != 0)
+    {
+        goto error;
+    }
+    dev->state = XenbusStateInitialising;
+
+    /* Fires once straight away, which picks up the current state */
+    dev->otherend_state = XenbusStateUnknown;
+    snprintf(path, sizeof(path), "%s/state", dev->otherend);
+    dev->otherend_watch = xenstore_watch(path, otherend_changed, dev);
+
+    return 0;
+
+error:
+    vSemaphoreDelete(dev->otherend_changed);
+    dev->otherend_changed = NULL;
+
+    return -1;
+}
+
+void xenbus_device_free(struct xenbus_device * dev)
+{
+    if(dev->otherend_watch >= 0)
+    {
+        xenstore_unwatch(dev->otherend_watch);
+        dev->otherend_watch = -1;
+    }
+
+    if(dev->otherend_changed != NULL)
+    {
+        vSemaphoreDelete(dev->otherend_changed);
+        dev->otherend_changed = NULL;
+    }
+}
+
+/*
+ * Waits up to timeout_ms for the backend to reach state, or to give up on the
+ * device by closing. Returns the backend state then, or -1 on timeout.
+ * Before the scheduler runs the state is only read once.
+ */
+int xenbus_wait_otherend(struct xenbus_device * dev, XenbusState state,
+    unsigned int timeout_ms)
+{
+    TickType_t ticks;
+    TickType_t start;
+    TickType_t waited;
+    TickType_t wait;
+    int        can_block;
+    int        current;
+
+    can_block = xen_can_block();
+    ticks = (timeout_ms == XENBUS_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    start = can_block ? xTaskGetTickCount() : 0;
+
+    for(;;)
+    {
+        /* Watch events only arrive once tasks run, read it directly before */
+        if(dev->otherend_watch >= 0 && can_block)
+        {
+            current = dev->otherend_state;
+        }
+        else
         {
-            goto error;
+            current = read_otherend_state(dev);
         }
 
-        if(sscanf(strvalue, "%d", &current_state) != 1)
+        if(current >= (int)state || current >= XenbusStateClosing)
         {
-            goto error;
+            return current;
         }
 
-        free(strvalue);
+        if(!can_block)
+        {
+            return -1;
+        }
 
-        /* Write the new device state if it has changed */
-        if(current_state != state)
+        waited = xTaskGetTickCount() - start;
+        if(ticks != portMAX_DELAY && waited >= ticks)
         {
-            if(xenstore_printf(trans_id, path, "state", "%d", state) < 0)
-            {
-                goto error;
-            }
+            return -1;
         }
+        wait = (ticks == portMAX_DELAY) ? portMAX_DELAY : ticks - waited;
 
-        /* End transaction if it was started by this function */
-        if(xbt_flag)
+        if(dev->otherend_watch >= 0)
         {
-            if(xenstore_transaction_end(trans_id, 0, &again) != 0)
+            xSemaphoreTake(dev->otherend_changed, wait);
+        }
+        else
+        {
+            if(wait > pdMS_TO_TICKS(OTHEREND_POLL_MS) + 1)
             {
-                goto error;
+                wait = pdMS_TO_TICKS(OTHEREND_POLL_MS) + 1;
             }
-
-            trans_id = XBT_NIL;
+            vTaskDelay(wait);
         }
     }
+}
 
-    return 0;
-
-error:
-    free(strvalue);
+/*
+ * Writes the device's details with publish and switches the device to state,
+ * all in one transaction, which is repeated if xenstore asks for that.
+ */
+int xenbus_publish(struct xenbus_device * dev, xenbus_publish_t publish,
+    void * arg, XenbusState state)
+{
+    xenbus_transaction_t trans_id;
+    int                  again;
 
-    if(xbt_flag && trans_id != XBT_NIL)
+    do
     {
-        xenstore_transaction_end(trans_id, 0, &again);
-    }
+        if(xenstore_transaction_start(&trans_id) != 0)
+        {
+            return -1;
+        }
 
-    return -1;
+        if((publish != NULL && publish(trans_id, arg) != 0) ||
+           xenstore_printf(trans_id, dev->nodename, "state", "%d", state) < 0)
+        {
+            xenstore_transaction_end(trans_id, 1, &again);
+            return -1;
+        }
+
+        if(xenstore_transaction_end(trans_id, 0, &again) != 0)
+        {
+            return -1;
+        }
+    } while(again);
+
+    dev->state = state;
+
+    return 0;
 }
@@ -19,16 +19,47 @@
 #define _XEN_BUS_H_
 
 /******** Includes ************************************************************/
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include "xen/xen.h"
 #include "xen/io/xenbus.h"
 #include "xen_store.h"
 
 
 /******** Definitions *********************************************************/
+#ifndef XENBUS_PATH_MAX
+#define XENBUS_PATH_MAX     128
+#endif
+
+#define XENBUS_WAIT_FOREVER 0xFFFFFFFFU
+
+/* A frontend device and what it knows of its backend, the other end */
+struct xenbus_device
+{
+    char                 nodename[XENBUS_PATH_MAX];
+    char                 otherend[XENBUS_PATH_MAX];
+    domid_t              otherend_id;
+    XenbusState          state;
+    volatile XenbusState otherend_state;
+    int                  otherend_watch;    /* -1 if the state is polled */
+    SemaphoreHandle_t    otherend_changed;
+};
+
+/* Writes the device's details to xenstore within trans_id */
+typedef int (*xenbus_publish_t)(xenbus_transaction_t trans_id, void * arg);
 
 
 /******** Public Functions ****************************************************/
 int xenbus_switch_state(xenbus_transaction_t trans_id,
     const char* path, XenbusState state);
 
+int  xenbus_device_init(struct xenbus_device * dev, const char * nodename);
+void xenbus_device_free(struct xenbus_device * dev);
+int  xenbus_wait_otherend(struct xenbus_device * dev, XenbusState state,
+    unsigned int timeout_ms);
+int  xenbus_publish(struct xenbus_device * dev, xenbus_publish_t publish,
+    void * arg, XenbusState state);
+
 
 #endif /* _XEN_BUS_H_ */
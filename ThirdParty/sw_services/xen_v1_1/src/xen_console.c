@@ -61,11 +61,36 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "xen/io/console.h"
 #include "xen_console.h"
 #include "xen_events.h"
+#include "xen_log.h"
+#include "semphr.h"
+#include "xen_ring.h"
 #include "xzd_bmc.h"
 #include "mm.h"
 
 //#define ECHO_TO_UART 1
 
+// size of the guest side console overflow buffer, a power of two
+#ifndef CONSOLE_SPILL_SIZE
+#define CONSOLE_SPILL_SIZE 8192
+#endif
+
+// size of the buffer received characters wait in for xen_console_read(), a
+// power of two
+#ifndef CONSOLE_INPUT_SIZE
+#define CONSOLE_INPUT_SIZE 1024
+#endif
+
+// stack for the task that drains the printk log ring, in words
+#ifndef CONSOLE_LOG_STACK_DEPTH
+#define CONSOLE_LOG_STACK_DEPTH 512
+#endif
+
+// longest printk() message formatted in an interrupt handler, which uses its
+// own stack for it
+#ifndef CONSOLE_ISR_PRINT_SIZE
+#define CONSOLE_ISR_PRINT_SIZE 256
+#endif
+
 // structure for asking Xen for some values
 struct xen_param {
     u16  domid;
@@ -76,6 +101,31 @@ struct xen_param {
 static int console_initialised = 0;
 static u64 guest_phys_page = -1;
 static u32 cons_evtch = -1;
+static TaskHandle_t console_log_task_handle = NULL;
+
+// serializes tasks formatting into pvc_print()'s buffer, as writing it out
+// can block
+static SemaphoreHandle_t pvc_lock = NULL;
+
+// what console_write() does with output that does not fit in the out ring
+static int console_policy = CONSOLE_OVERFLOW_DROP;
+static TickType_t console_block_ticks = 0;
+static SemaphoreHandle_t console_space_sem = NULL;
+
+// overflow buffer for CONSOLE_OVERFLOW_SPILL, emptied on the console event
+static char spill_buf[CONSOLE_SPILL_SIZE];
+static u32 spill_prod = 0;
+static u32 spill_cons = 0;
+
+// received characters for xen_console_read() in CONSOLE_INPUT_STREAM mode
+static int console_input_mode = CONSOLE_INPUT_CALLBACK;
+static SemaphoreHandle_t console_input_sem = NULL;
+static char input_buf[CONSOLE_INPUT_SIZE];
+static u32 input_prod = 0;
+static u32 input_cons = 0;
+
+static console_stats_t console_stats;
+static u32 log_dropped_base = 0;
 
 static void default_console_input_callback(char* data, int size)
 {
@@ -142,89 +192,260 @@ static int get_hv_param(int param_id, uint64_t *value)
     return ret;
 }
 
-// Copies the outgoing characters into the ring buffer
-static int xencons_ring_send_no_notify(const u8 *data, unsigned int len)
+// Streams the characters into a byte ring, turning each "\n" into "\r\n" on
+// the way unless raw is set, until the ring is full. Returns how many of the
+// input characters were consumed.
+static int ring_put(char *ring, u32 size, u32 cons, u32 *prod, const char *data, int length, int raw)
 {
+    const char *nl;
+    u32 space, run;
     int sent = 0;
-	struct xencons_interface *intf;
-	u32 cons, prod;
 
+    while(sent < length)
+    {
+        space = size - (*prod - cons);
 
-	intf = mfn_to_virt(guest_phys_page);
-	cons = intf->out_cons;
-	prod = intf->out_prod;
-	mb();
-	BUG_ON((prod - cons) > sizeof(intf->out));
+        // copy up to the next newline in bulk
+        nl = raw ? NULL : memchr(data + sent, '\n', length - sent);
+        run = (nl != NULL) ? (u32)(nl - (data + sent)) : (u32)(length - sent);
+        if(run > space)
+            run = space;
 
-	while ((sent < len) && ((prod - cons) < sizeof(intf->out)))
-	{
-		intf->out[MASK_XENCONS_IDX(prod++, intf->out)] = data[sent++];
-	}
-	wmb();
-	intf->out_prod = prod;
+        xen_ring_copy_in(ring, size, *prod, data + sent, run);
+        *prod += run;
+        sent += run;
+        space -= run;
+
+        if(nl == NULL || data + sent != nl)
+            break;
+
+        // the newline itself, only if both characters fit
+        if(space < 2)
+            break;
+
+        ring[(*prod)++ & (size - 1)] = '\r';
+        ring[(*prod)++ & (size - 1)] = '\n';
+        sent++;
+    }
 
     return sent;
 }
 
-// Copies the characters then raises an event to Xen
-static int xencons_ring_send(const u8 *data, unsigned len)
+// Moves as much of the spill buffer into the out ring as fits, interrupts
+// must be masked
+static void spill_flush(struct xencons_interface *intf, u32 *prod)
 {
-    int sent;
+    u32 cons = intf->out_cons;
+    u32 used, run;
 
-    sent = xencons_ring_send_no_notify(data, len);
-    notify_evtch(cons_evtch);
+    mb();
+    while((used = spill_prod - spill_cons) != 0)
+    {
+        // the contiguous part of the spill buffer
+        run = CONSOLE_SPILL_SIZE - (spill_cons & (CONSOLE_SPILL_SIZE - 1));
+        if(run > used)
+            run = used;
+
+        run = ring_put(intf->out, sizeof(intf->out), cons, prod,
+            &spill_buf[spill_cons & (CONSOLE_SPILL_SIZE - 1)], run, 1);
+        if(run == 0)
+            break;
+
+        spill_cons += run;
+        console_stats.bytes_written += run;
+    }
+}
 
-    return sent;
+// The two halves of the console page in the form the ring helpers take
+static inline xen_byte_ring_t out_ring(struct xencons_interface *intf)
+{
+    xen_byte_ring_t ring = { intf->out, sizeof(intf->out), &intf->out_prod, &intf->out_cons };
+    return ring;
 }
 
-// Does some data reformatting to handle newline
-static void console_print(char *data, int length)
+static inline xen_byte_ring_t in_ring(struct xencons_interface *intf)
 {
-    u8 *curr_char, saved_char;
-    u8 copied_str[length+1];
-    u8 *copied_ptr;
-    int part_len;
-    int (*ring_send_fn)(const u8 *data, unsigned length);
+    xen_byte_ring_t ring = { intf->in, sizeof(intf->in), &intf->in_prod, &intf->in_cons };
+    return ring;
+}
 
-    if(!console_initialised)
-        ring_send_fn = xencons_ring_send_no_notify;
-    else
-        ring_send_fn = xencons_ring_send;
+// Publishes the new producer index. Returns 1 if xenconsoled may be idle and
+// has to be notified, which callers do once out of their critical section.
+static int out_publish(struct xencons_interface *intf, u32 old_prod, u32 prod, int notify)
+{
+    xen_byte_ring_t out = out_ring(intf);
 
-    copied_ptr = copied_str;
-    memcpy(copied_ptr, data, length);
+    return xen_ring_publish_prod(&out, old_prod, prod) && notify && console_initialised;
+}
 
-    for(curr_char = copied_ptr; curr_char < copied_ptr+length-1; curr_char++)
+// Only a running task can wait for xenconsoled
+static int console_can_block(void)
+{
+    return console_space_sem != NULL && xen_can_block();
+}
+
+// Writes the characters to the out ring, see console_write(). Returns the
+// number consumed, whether the caller should block and retry in *wait, and
+// whether it has to notify xenconsoled in *kick.
+static int console_write_locked(struct xencons_interface *intf, const char *data,
+    int length, int notify, int raw, int *wait, int *kick)
+{
+    u32 cons, prod, old_prod;
+    int sent = 0;
+    int rest;
+
+    *wait = 0;
+
+    prod = intf->out_prod;
+    old_prod = prod;
+    BUG_ON((prod - intf->out_cons) > sizeof(intf->out));
+
+    // older spilled output goes first
+    spill_flush(intf, &prod);
+
+    cons = intf->out_cons;
+    mb();
+    if(spill_prod == spill_cons &&
+       (!raw || (u32)length <= sizeof(intf->out) - (prod - cons)))
+    {
+        sent = ring_put(intf->out, sizeof(intf->out), cons, &prod, data, length, raw);
+        console_stats.bytes_written += sent;
+    }
+
+    rest = length - sent;
+    if(rest > 0)
     {
-        if(*curr_char == '\n')
+        switch(console_policy)
+        {
+        case CONSOLE_OVERFLOW_SPILL:
+            if(!raw || (u32)rest <= CONSOLE_SPILL_SIZE - (spill_prod - spill_cons))
+            {
+                rest = ring_put(spill_buf, CONSOLE_SPILL_SIZE, spill_cons, &spill_prod,
+                    data + sent, rest, raw);
+                console_stats.bytes_spilled += rest;
+                sent += rest;
+                if(spill_prod - spill_cons > console_stats.spill_high_water)
+                    console_stats.spill_high_water = spill_prod - spill_cons;
+            }
+            break;
+
+        case CONSOLE_OVERFLOW_BLOCK:
+            if(console_can_block())
+            {
+                // xenconsoled has to hear about the full ring to drain it
+                notify = 1;
+                *wait = 1;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    *kick = out_publish(intf, old_prod, prod, notify);
+
+    return sent;
+}
+
+// Streams the characters into the out ring, turning each "\n" into "\r\n" on
+// the way unless raw is set. Raw data is written whole or not at all. The ring
+// index is published once and Xen notified at most once, unless the write has
+// to wait for xenconsoled. When the ring is full the overflow policy decides
+// between dropping the rest, waiting for space and spilling into the guest
+// side overflow buffer.
+static int console_write(const char *data, int length, int notify, int raw)
+{
+    struct xencons_interface *intf = mfn_to_virt(guest_phys_page);
+    TickType_t start = 0;
+    TickType_t waited;
+    UBaseType_t mask;
+    int blocked = 0;
+    int sent = 0;
+    int wait;
+    int kick;
+
+    for(;;)
+    {
+        mask = taskENTER_CRITICAL_FROM_ISR();
+        sent += console_write_locked(intf, data + sent, length - sent, notify, raw,
+            &wait, &kick);
+        taskEXIT_CRITICAL_FROM_ISR(mask);
+
+        if(kick)
+            notify_evtch(cons_evtch);
+
+        if(!wait)
+            break;
+
+        if(!blocked)
+        {
+            blocked = 1;
+            start = xTaskGetTickCount();
+            console_stats.blocked++;
+        }
+
+        waited = xTaskGetTickCount() - start;
+        if(waited >= console_block_ticks ||
+           xSemaphoreTake(console_space_sem, console_block_ticks - waited) != pdTRUE)
         {
-            *curr_char = '\r';
-            saved_char = *(curr_char+1);
-            *(curr_char+1) = '\n';
-            part_len = curr_char - copied_ptr + 2;
-            ring_send_fn(copied_ptr, part_len);
-            *(curr_char+1) = saved_char;
-            copied_ptr = curr_char+1;
-            length -= part_len - 1;
+            console_stats.block_timeouts++;
+            break;
         }
     }
 
-    if (copied_ptr[length-1] == '\n') {
-        copied_ptr[length-1] = '\r';
-        copied_ptr[length] = '\n';
-        length++;
+    if(sent < length)
+    {
+        console_stats.bytes_dropped += length - sent;
     }
 
-    ring_send_fn(copied_ptr, length);
+    return sent;
 }
 
-// This function will print to Xen's console one way or another
-static void pvc_print(int direct, const char *fmt, va_list args)
+// Picks what happens to output that does not fit in the console ring.
+// timeout_ms bounds how long a task waits under CONSOLE_OVERFLOW_BLOCK.
+int console_set_overflow_policy(int policy, unsigned int timeout_ms)
 {
-    static char   buf[1024];
+    switch(policy)
+    {
+    case CONSOLE_OVERFLOW_BLOCK:
+        if(console_space_sem == NULL)
+        {
+            console_space_sem = xSemaphoreCreateBinary();
+            if(console_space_sem == NULL)
+                return -1;
+        }
+        console_block_ticks = pdMS_TO_TICKS(timeout_ms);
+        break;
 
-    (void)vsnprintf(buf, sizeof(buf), fmt, args);
+    case CONSOLE_OVERFLOW_DROP:
+    case CONSOLE_OVERFLOW_SPILL:
+        break;
+
+    default:
+        return -1;
+    }
+
+    console_policy = policy;
+
+    return 0;
+}
 
+void console_get_stats(console_stats_t *stats)
+{
+    memcpy(stats, &console_stats, sizeof(*stats));
+    stats->log_records_dropped = xen_log_dropped() - log_dropped_base;
+}
+
+void console_reset_stats(void)
+{
+    memset(&console_stats, 0, sizeof(console_stats));
+    log_dropped_base = xen_log_dropped();
+}
+
+// Writes a formatted message to Xen's console, with the hypercall if direct
+static void pvc_write(int direct, char *buf)
+{
     if(direct)
     {
     	// if console ring buffer/event not ready,  use the Xen console IO hypercall
@@ -232,7 +453,38 @@ static void pvc_print(int direct, const char *fmt, va_list args)
     }
     else
     {
-        console_print(buf, strlen(buf));
+        (void)console_write(buf, strlen(buf), 1, 0);
+    }
+}
+
+// This function will print to Xen's console one way or another
+static void pvc_print(int direct, const char *fmt, va_list args)
+{
+    static char   buf[1024];
+    char          isr_buf[CONSOLE_ISR_PRINT_SIZE];
+    int           locked = 0;
+
+    if(xen_in_isr())
+    {
+        // may have interrupted a task using buf
+        (void)vsnprintf(isr_buf, sizeof(isr_buf), fmt, args);
+        pvc_write(direct, isr_buf);
+        return;
+    }
+
+    // before the scheduler runs there is nobody to share buf with
+    if(pvc_lock != NULL && xen_can_block())
+    {
+        xSemaphoreTake(pvc_lock, portMAX_DELAY);
+        locked = 1;
+    }
+
+    (void)vsnprintf(buf, sizeof(buf), fmt, args);
+    pvc_write(direct, buf);
+
+    if(locked)
+    {
+        xSemaphoreGive(pvc_lock);
     }
 }
 
@@ -241,39 +493,372 @@ void printk(const char *fmt, ...)
 {
     va_list       args;
 	va_start(args, fmt);
-    pvc_print(console_initialised!=1, fmt, args);
+    if(console_initialised && xen_log_has_consumer())
+    {
+        // lock free, the log task copies it to the ring later
+        (void)xen_log_vprintf(fmt, args);
+    }
+    else
+    {
+        pvc_print(console_initialised!=1, fmt, args);
+    }
+    va_end(args);
+}
+
+// Builds a binary log record, see xen_console.h for the layout
+static unsigned int xlog_encode(u8 *buf, u8 flags, u32 fmt, unsigned int nargs, va_list args)
+{
+    struct xlog_hdr *hdr = (struct xlog_hdr *)buf;
+    u64 *arg = (u64 *)(hdr + 1);
+    unsigned int i;
+
+    hdr->magic[0] = XLOG_MAGIC0;
+    hdr->magic[1] = XLOG_MAGIC1;
+    hdr->nargs = nargs;
+    hdr->flags = flags;
+    hdr->fmt = fmt;
+    hdr->timestamp = read_cntvct();
+
+    for(i = 0; i < nargs; i++)
+    {
+        arg[i] = va_arg(args, u64);
+    }
+
+    return sizeof(*hdr) + (nargs * sizeof(u64));
+}
+
+// Writes a binary record to the log ring, or straight to the console ring
+// while there is no log task. Records before init_console() are discarded,
+// since the hypervisor console only passes printable text. Returns 0 if the
+// record was queued or written whole, -1 if it was dropped.
+static int xlog_write(u8 flags, u32 fmt, unsigned int nargs, va_list args)
+{
+    xen_log_rec_t *rec;
+    u8 buf[XLOG_REC_MAX];
+    unsigned int len;
+
+    if(!console_initialised)
+    {
+        return -1;
+    }
+
+    if(xen_log_has_consumer())
+    {
+        rec = xen_log_reserve(XLOG_REC_MAX);
+        if(rec == NULL)
+        {
+            return -1;
+        }
+        len = xlog_encode(xen_log_data(rec), flags, fmt, nargs, args);
+        rec->flags = LOG_REC_F_RAW;
+        xen_log_commit(rec, len);
+    }
+    else
+    {
+        len = xlog_encode(buf, flags, fmt, nargs, args);
+        if(console_write((const char *)buf, len, 1, 1) != (int)len)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int xlog_write_clock(u8 flags, unsigned int nargs, ...)
+{
+    va_list args;
+    int ret;
+
+    va_start(args, nargs);
+    ret = xlog_write(flags, 0, nargs, args);
     va_end(args);
+
+    return ret;
+}
+
+// Called by XLOG() when binary logging is on. The format string stays in the
+// image, the record carries its offset in the xen_logfmt section and the raw
+// arguments, each cast to u64.
+void xlog_emit(const char *fmt, unsigned int nargs, ...)
+{
+    // weak, the linker only defines it once an XLOG() site exists
+    extern const char __start_xen_logfmt[] __attribute__((weak));
+    // 0 not sent yet, 1 being sent, 2 sent
+    static u32 clock_state = 0;
+    u32 expected = 0;
+    va_list args;
+
+    if(nargs > XLOG_MAX_ARGS)
+    {
+        nargs = XLOG_MAX_ARGS;
+    }
+
+    // the decoder needs the counter frequency to turn timestamps into time,
+    // so a clock record that was dropped is sent again with the next record
+    if(console_initialised &&
+       __atomic_compare_exchange_n(&clock_state, &expected, 1, 0,
+           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&clock_state,
+            (xlog_write_clock(XLOG_F_CLOCK, 1, read_cntfrq()) == 0) ? 2 : 0,
+            __ATOMIC_RELAXED);
+    }
+
+    va_start(args, nargs);
+    (void)xlog_write(0, (u32)(fmt - __start_xen_logfmt), nargs, args);
+    va_end(args);
+}
+
+// Copies one log record into the out ring, the log task notifies once after
+static void console_log_write(const xen_log_rec_t * rec, const void * data)
+{
+    if(rec->len > 0)
+    {
+        (void)console_write(data, rec->len, 0, rec->flags & LOG_REC_F_RAW);
+    }
+}
+
+// Moves everything committed to the log ring into the console ring, batching
+// the records behind a single notification
+static void console_log_task(void * arg)
+{
+    struct xencons_interface *intf = mfn_to_virt(guest_phys_page);
+    u32 old_prod;
+
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        old_prod = intf->out_prod;
+        xen_log_drain(console_log_write);
+
+        mb();
+        if(intf->out_prod != old_prod && xen_ring_push_check_notify(old_prod, intf->out_cons))
+        {
+            notify_evtch(cons_evtch);
+        }
+    }
+}
+
+// Starts the task that printk hands its output to. Until it is started
+// printk copies to the console ring itself, one caller at a time.
+int init_console_log_task(unsigned int priority)
+{
+    if(!console_initialised || console_log_task_handle != NULL)
+    {
+        return -1;
+    }
+
+    if(xTaskCreate(console_log_task, "xencons", CONSOLE_LOG_STACK_DEPTH, NULL,
+        (UBaseType_t)priority, &console_log_task_handle) != pdPASS)
+    {
+        console_log_task_handle = NULL;
+        return -1;
+    }
+
+    xen_log_set_consumer(console_log_task_handle);
+
+    return 0;
+}
+
+
+// xenconsoled has made space in the out ring: move spilled output into it and
+// wake a task waiting to write
+static void console_handle_output(void)
+{
+	struct xencons_interface *intf = mfn_to_virt(guest_phys_page);
+	BaseType_t woken = pdFALSE;
+	UBaseType_t mask;
+	u32 prod, old_prod;
+	int kick;
+
+	if (spill_prod != spill_cons)
+	{
+		mask = taskENTER_CRITICAL_FROM_ISR();
+		prod = old_prod = intf->out_prod;
+		spill_flush(intf, &prod);
+		kick = out_publish(intf, old_prod, prod, 1);
+		taskEXIT_CRITICAL_FROM_ISR(mask);
+
+		if (kick)
+			notify_evtch(cons_evtch);
+	}
+
+	if (console_space_sem != NULL)
+	{
+		if (xen_in_isr())
+		{
+			xSemaphoreGiveFromISR(console_space_sem, &woken);
+			portYIELD_FROM_ISR(woken);
+		}
+		else
+		{
+			xSemaphoreGive(console_space_sem);
+		}
+	}
 }
 
+// Moves as much of the in ring into the input buffer as fits, interrupts must
+// be masked. What does not fit stays in the in ring until a reader makes room,
+// so xenconsoled is held off rather than input lost. Returns the number of
+// bytes moved, and in *notify whether xenconsoled needs to hear about it.
+static int input_pull(struct xencons_interface *intf, int *notify)
+{
+	xen_byte_ring_t in = in_ring(intf);
+	u32 cons, n;
+
+	n = xen_ring_readable(&in, &cons);
+	BUG_ON(n > sizeof(intf->in));
+
+	if (n > CONSOLE_INPUT_SIZE - (input_prod - input_cons))
+		n = CONSOLE_INPUT_SIZE - (input_prod - input_cons);
+
+	*notify = 0;
+	if (n == 0)
+		return 0;
+
+	xen_ring_copy_ring(input_buf, CONSOLE_INPUT_SIZE, input_prod, intf->in, sizeof(intf->in), cons, n);
+	input_prod += n;
+
+	*notify = xen_ring_publish_cons(&in, cons, cons + n, 1);
+
+	return n;
+}
 
 // Register this function with event handler to take care of console events
 static void console_handle_input(void * arg)
 {
 	struct xencons_interface *intf = mfn_to_virt(guest_phys_page);
-	u32 cons, prod;
-	u8 byte;
-	static int cr = 0;
+	xen_byte_ring_t in;
 	char data[sizeof(intf->in)+1] = {0};
+	BaseType_t woken = pdFALSE;
+	UBaseType_t mask;
 	int i;
+	int notify;
 
 
-	cons = intf->in_cons;
-	prod = intf->in_prod;
-	mb();
-	BUG_ON((prod - cons) > sizeof(intf->in));
+	if (console_input_mode == CONSOLE_INPUT_STREAM)
+	{
+		// constant time, readers copy the bytes out in task context
+		mask = taskENTER_CRITICAL_FROM_ISR();
+		i = input_pull(intf, &notify);
+		taskEXIT_CRITICAL_FROM_ISR(mask);
+	}
+	else
+	{
+		// xenconsoled only needs to hear about the space if the in ring was full
+		in = in_ring(intf);
+		i = xen_ring_read(&in, data, sizeof(intf->in), 1, &notify);
+	}
 
-	i = 0;
-	while (cons != prod)
+	// xenconsoled raises this event after draining the out ring, but does not
+	// look at the ring again. If a send was suppressed while it was draining,
+	// output is still waiting there.
+	if (intf->out_prod != intf->out_cons)
 	{
-		byte =  *(intf->in+MASK_XENCONS_IDX(cons,intf->in));
-		cons++;
-		data[i++] = byte;
+		notify = 1;
 	}
 
-	mb();
-	intf->in_cons = cons;
-	notify_evtch(cons_evtch);
-	console_input_callback(data, i);
+	if (notify)
+	{
+		notify_evtch(cons_evtch);
+	}
+
+	console_handle_output();
+
+	if (i > 0)
+	{
+		if (console_input_mode == CONSOLE_INPUT_STREAM)
+		{
+			if (xen_in_isr())
+			{
+				xSemaphoreGiveFromISR(console_input_sem, &woken);
+				portYIELD_FROM_ISR(woken);
+			}
+			else
+			{
+				xSemaphoreGive(console_input_sem);
+			}
+		}
+		else
+		{
+			console_input_callback(data, i);
+		}
+	}
+}
+
+// Chooses how received characters are delivered: to the registered callback
+// in the event handler (CONSOLE_INPUT_CALLBACK), or buffered for tasks to
+// collect with xen_console_read() (CONSOLE_INPUT_STREAM).
+int console_set_input_mode(int mode)
+{
+	if (mode == CONSOLE_INPUT_STREAM && console_input_sem == NULL)
+	{
+		console_input_sem = xSemaphoreCreateBinary();
+		if (console_input_sem == NULL)
+			return -1;
+	}
+	else if (mode != CONSOLE_INPUT_STREAM && mode != CONSOLE_INPUT_CALLBACK)
+	{
+		return -1;
+	}
+
+	console_input_mode = mode;
+
+	return 0;
+}
+
+// Reads up to len received characters, waiting up to timeout_ms for the first
+// one (CONSOLE_WAIT_FOREVER to wait indefinitely). Returns the number read,
+// 0 on timeout, or -1 if the console is not in CONSOLE_INPUT_STREAM mode.
+// Only tasks may call this.
+int xen_console_read(char *buf, int len, unsigned int timeout_ms)
+{
+	struct xencons_interface *intf = mfn_to_virt(guest_phys_page);
+	TickType_t ticks, start, waited;
+	UBaseType_t mask;
+	u32 n;
+	int notify = 0;
+
+	if (console_input_mode != CONSOLE_INPUT_STREAM || !console_initialised ||
+	    buf == NULL || len <= 0 || xen_in_isr())
+	{
+		return -1;
+	}
+
+	ticks = (timeout_ms == CONSOLE_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+	start = xTaskGetTickCount();
+
+	for (;;)
+	{
+		mask = taskENTER_CRITICAL_FROM_ISR();
+		n = input_prod - input_cons;
+		if (n > (u32)len)
+			n = len;
+		if (n > 0)
+		{
+			// copy out, then refill from anything held back in the in ring
+			xen_ring_copy_out(buf, input_buf, CONSOLE_INPUT_SIZE, input_cons, n);
+			input_cons += n;
+			(void)input_pull(intf, &notify);
+		}
+		taskEXIT_CRITICAL_FROM_ISR(mask);
+
+		if (notify)
+			notify_evtch(cons_evtch);
+
+		if (n > 0)
+			return n;
+
+		waited = xTaskGetTickCount() - start;
+		if (ticks != portMAX_DELAY && waited >= ticks)
+			return 0;
+
+		if (xSemaphoreTake(console_input_sem,
+		        (ticks == portMAX_DELAY) ? portMAX_DELAY : ticks - waited) != pdTRUE)
+			return 0;
+	}
 }
 
 // Initializes the Xen virtual console
@@ -310,5 +895,6 @@ void init_console(void)
     }
 
     unmask_evtchn(cons_evtch);
+    pvc_lock = xSemaphoreCreateMutex();
     console_initialised = 1;
 }
@@ -17,11 +17,97 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #ifndef _XEN_CONSOLE_H_
 
+#include <stdint.h>
+#include "types.h"
+
+// Set to 1 to make XLOG() write binary records instead of formatting text
+#ifndef XEN_LOG_BINARY
+#define XEN_LOG_BINARY 0
+#endif
+
 typedef void (*callback_func)(char* data, int size);
 
+// What happens to console output when xenconsoled falls behind
+#define CONSOLE_OVERFLOW_DROP   0   // discard what does not fit, and count it
+#define CONSOLE_OVERFLOW_BLOCK  1   // the writing task waits for space, up to a timeout
+#define CONSOLE_OVERFLOW_SPILL  2   // queue it in a guest side buffer drained on the console event
+
+// How received characters are delivered
+#define CONSOLE_INPUT_CALLBACK  0   // to the registered callback, in the event handler
+#define CONSOLE_INPUT_STREAM    1   // buffered for xen_console_read()
+
+#define CONSOLE_WAIT_FOREVER    0xFFFFFFFFU
+
+typedef struct console_stats {
+    u32 bytes_written;          // characters put in the out ring
+    u32 bytes_dropped;          // input characters that were lost
+    u32 bytes_spilled;          // characters queued in the overflow buffer
+    u32 spill_high_water;       // most the overflow buffer has held
+    u32 blocked;                // writes that had to wait for xenconsoled
+    u32 block_timeouts;         // waits that gave up
+    u32 log_records_dropped;    // printk messages lost to a full log ring
+} console_stats_t;
+
+/*
+Binary log records, decoded on the host by tools/xlog_decode.py. A record is
+the header followed by nargs little endian u64 arguments. fmt is the offset of
+the format string in the xen_logfmt section of the ELF, timestamp is CNTVCT.
+A record with XLOG_F_CLOCK carries the counter frequency in its argument.
+Arguments must be integers or pointers, and %s must point into the image.
+*/
+#define XLOG_MAGIC0     0xFE
+#define XLOG_MAGIC1     0xB1
+#define XLOG_F_CLOCK    0x01
+#define XLOG_MAX_ARGS   8
+
+struct xlog_hdr {
+    u8  magic[2];
+    u8  nargs;
+    u8  flags;
+    u32 fmt;
+    u64 timestamp;
+} __attribute__((packed));
+
+#define XLOG_REC_MAX    (sizeof(struct xlog_hdr) + (XLOG_MAX_ARGS * sizeof(u64)))
+
+void xlog_emit(const char *fmt, unsigned int nargs, ...);
+
+#define XLOG_NARGS(...) XLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define XLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+#define XLOG_U64(x)     ((u64)(uintptr_t)(x))
+#define XLOG_ARGS_0()
+#define XLOG_ARGS_1(a)                          , XLOG_U64(a)
+#define XLOG_ARGS_2(a, b)                       XLOG_ARGS_1(a) XLOG_ARGS_1(b)
+#define XLOG_ARGS_3(a, b, c)                    XLOG_ARGS_2(a, b) XLOG_ARGS_1(c)
+#define XLOG_ARGS_4(a, b, c, d)                 XLOG_ARGS_3(a, b, c) XLOG_ARGS_1(d)
+#define XLOG_ARGS_5(a, b, c, d, e)              XLOG_ARGS_4(a, b, c, d) XLOG_ARGS_1(e)
+#define XLOG_ARGS_6(a, b, c, d, e, f)           XLOG_ARGS_5(a, b, c, d, e) XLOG_ARGS_1(f)
+#define XLOG_ARGS_7(a, b, c, d, e, f, g)        XLOG_ARGS_6(a, b, c, d, e, f) XLOG_ARGS_1(g)
+#define XLOG_ARGS_8(a, b, c, d, e, f, g, h)     XLOG_ARGS_7(a, b, c, d, e, f, g) XLOG_ARGS_1(h)
+#define XLOG_ARGS_N(n)  XLOG_ARGS_N_(n)
+#define XLOG_ARGS_N_(n) XLOG_ARGS_##n
+
+// Logs like printk. fmt must be a string literal, at most 8 arguments.
+#if XEN_LOG_BINARY
+#define XLOG(fmt, ...) do { \
+    static const char xlog_fmt_[] __attribute__((section("xen_logfmt"), used)) = "" fmt; \
+    xlog_emit(xlog_fmt_, XLOG_NARGS(__VA_ARGS__) \
+        XLOG_ARGS_N(XLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)); \
+} while(0)
+#else
+#define XLOG(fmt, ...)  printk(fmt, ##__VA_ARGS__)
+#endif
+
 void printk(const char *fmt, ...);
 void init_console(void);
+int init_console_log_task(unsigned int priority);
 void register_console_callback(callback_func fptr);
+int console_set_overflow_policy(int policy, unsigned int timeout_ms);
+void console_get_stats(console_stats_t *stats);
+void console_reset_stats(void);
+int console_set_input_mode(int mode);
+int xen_console_read(char *buf, int len, unsigned int timeout_ms);
 
 
 #define _XEN_CONSOLE_H_
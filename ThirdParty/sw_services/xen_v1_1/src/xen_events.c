@@ -16,60 +16,281 @@ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
 #include "xen/xen.h"
 #include "hypercall.h"
 #include "arm64_ops.h"
 #include "mm.h"
 #include "xen_events.h"
+#include "xen_events_fifo.h"
 #include "xen_console.h"
 #include "xen/memory.h"
 #include "xen/event_channel.h"
+#include "xen/vcpu.h"
+#include "xen/sched.h"
 
 #define active_evtchns(cpu,sh,idx)              \
     ((sh)->evtchn_pending[idx] &                \
+     evtchn_cpu_mask[cpu][idx] &                \
      ~(sh)->evtchn_mask[idx])
 
-#define MAX_EVTCHN      32
+#define EVTCHN_WORD_BITS    (sizeof(xen_ulong_t) * 8)
+#define EVTCHN_2L_NR_WORDS  (EVTCHN_2L_NR_CHANNELS / EVTCHN_WORD_BITS)
+#define EVTCHN_NR_WORDS     ((EVTCHN_MAX_PORTS + EVTCHN_WORD_BITS - 1) / EVTCHN_WORD_BITS)
+#define EVTCHN_NR_SEL_WORDS ((EVTCHN_NR_WORDS + EVTCHN_WORD_BITS - 1) / EVTCHN_WORD_BITS)
+
+#define EVTCHN_WORKER_STACK_MIN     256
 
 struct event_action
 {
 	evtchn_port_t port;
     evtchn_handler_t handler;
     void * data;
+    u8 deferred;
+    u8 worker;
+#if XEN_EVTCHN_STATS
+    evtchn_stats_t stats;
+#endif
 };
 typedef struct event_action event_action_t;
 
-static event_action_t event_action_table[MAX_EVTCHN] = {{0}};
+/*
+ * A worker task runs the handlers of deferred ports. The IRQ only sets the
+ * port in the worker's pending bitmap (and the word in its selector) with
+ * atomic ORs and then notifies the task, which swaps the bits back out.
+ */
+struct event_worker
+{
+    TaskHandle_t task;
+    xen_ulong_t  pending_sel[EVTCHN_NR_SEL_WORDS];
+    xen_ulong_t  pending[EVTCHN_NR_WORDS];
+};
+
+/*
+ * Handlers are kept in a two-tier table. The first tier is indexed by the
+ * evtchn_pending_sel bit (one word of evtchn_pending[]), the second by the
+ * bit within that word. Second tier blocks are allocated the first time a
+ * handler is registered for a port in that word and are never freed, so the
+ * IRQ path can walk the table without locking.
+ */
+static event_action_t * event_action_table[EVTCHN_NR_WORDS];
+static struct event_worker event_workers[EVTCHN_NR_WORKERS];
+static BaseType_t event_worker_woken[XEN_MAX_VCPUS];
+
+/*
+ * Each vCPU has its own pending selector in its vcpu_info. vCPU 0 starts out
+ * using the one in shared_info, the others have none until
+ * evtchn_register_vcpu_info() places one for them. The 64 byte alignment
+ * keeps every vcpu_info within a page, as Xen requires.
+ */
+struct vcpu_info_area
+{
+    vcpu_info_t info;
+} __attribute__((aligned(64)));
+
+static struct vcpu_info_area vcpu_info_area[XEN_MAX_VCPUS];
+static vcpu_info_t * vcpu_info_table[XEN_MAX_VCPUS];
+
+// 2-level ABI ports that each vCPU dispatches. Xen sends ports to vCPU 0 until
+// they are bound elsewhere.
+static xen_ulong_t evtchn_cpu_mask[XEN_MAX_VCPUS][EVTCHN_2L_NR_WORDS];
 static __attribute__((aligned(0x1000))) u8 shared_info_page[1<<PAGE_SHIFT];
 static struct shared_info* shared_info = NULL;
+#if XEN_EVTCHN_STATS
+static evtchn_irq_stats_t evtchn_irq_stats;
+#endif
+static int evtchn_abi = EVTCHN_ABI_2L;
+static int events_initialised = 0;
 int in_callback;
 
+static event_action_t * get_event_action(evtchn_port_t port);
 static int do_event(evtchn_port_t port);
+static void run_handler(event_action_t * action);
+static void defer_event(evtchn_port_t port, unsigned int worker);
+static void event_worker_task(void * arg);
 static void force_evtchn_callback(void);
+static void route_port(evtchn_port_t port, unsigned int vcpu);
+
+// Returns the handler slot for a port, or NULL if no slot has been allocated for it
+static inline event_action_t * get_event_action(evtchn_port_t port)
+{
+    event_action_t * block;
+
+    if(port >= EVTCHN_MAX_PORTS)
+    {
+        return NULL;
+    }
+
+    block = event_action_table[port / EVTCHN_WORD_BITS];
+    if(block == NULL)
+    {
+        return NULL;
+    }
 
-// This is where we would call the handler for the specific event, but for now only supporting 1 event
+    return &block[port % EVTCHN_WORD_BITS];
+}
+
+// Calls the handler registered for the port, if there is one
 static int do_event(evtchn_port_t port)
 {
     event_action_t * action;
 
     clear_evtchn(port);
 
-    if(port >= MAX_EVTCHN)
+    action = get_event_action(port);
+    if(action == NULL)
     {
+#if XEN_EVTCHN_STATS
+        __atomic_fetch_add(&evtchn_irq_stats.unbound, 1, __ATOMIC_RELAXED);
+#endif
         return 0;
     }
 
-    action = &event_action_table[port];
-
-    /* call the handler */
+    /* call the handler, or hand the port to its worker task */
     if(port == action->port && action->handler != NULL)
     {
-    	action->handler(action->data);
+        if(action->deferred)
+        {
+#if XEN_EVTCHN_STATS
+            __atomic_fetch_add(&action->stats.dispatched, 1, __ATOMIC_RELAXED);
+#endif
+            defer_event(port, action->worker);
+        }
+        else
+        {
+            run_handler(action);
+        }
+    }
+#if XEN_EVTCHN_STATS
+    else
+    {
+        __atomic_fetch_add(&action->stats.spurious, 1, __ATOMIC_RELAXED);
+        return 0;
     }
+#endif
 
     return 1;
 }
 
+// Calls a port's handler, timing it when statistics are enabled
+static inline void run_handler(event_action_t * action)
+{
+#if XEN_EVTCHN_STATS
+    u64 start, ticks, max;
+    unsigned int bucket = 0;
+
+    start = read_cntvct();
+    action->handler(action->data);
+    ticks = read_cntvct() - start;
+
+    if(ticks != 0)
+    {
+        bucket = 63 - __builtin_clzl(ticks);
+        if(bucket >= EVTCHN_STATS_HIST_BUCKETS)
+        {
+            bucket = EVTCHN_STATS_HIST_BUCKETS - 1;
+        }
+    }
+
+    /* A deferred port already counted the dispatch when it was queued */
+    if(!action->deferred)
+    {
+        __atomic_fetch_add(&action->stats.dispatched, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&action->stats.duration_hist[bucket], 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&action->stats.duration_max, __ATOMIC_RELAXED);
+    while(ticks > max &&
+          !__atomic_compare_exchange_n(&action->stats.duration_max, &max, ticks, 1,
+              __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+#else
+    action->handler(action->data);
+#endif
+}
+
+// Records the port as pending for the worker task and wakes it
+static void defer_event(evtchn_port_t port, unsigned int worker)
+{
+    struct event_worker * w = &event_workers[worker];
+    unsigned int word = port / EVTCHN_WORD_BITS;
+    unsigned int cpu = smp_processor_id();
+
+    __atomic_fetch_or(&w->pending[word], 1UL << (port % EVTCHN_WORD_BITS), __ATOMIC_SEQ_CST);
+    __atomic_fetch_or(&w->pending_sel[word / EVTCHN_WORD_BITS], 1UL << (word % EVTCHN_WORD_BITS),
+        __ATOMIC_SEQ_CST);
+
+    if(!xen_in_isr())
+    {
+        // force_evtchn_callback() runs handle_event_irq() from a task
+        xTaskNotifyGive(w->task);
+        return;
+    }
+
+    // handle_event_irq() yields to the worker once all ports are handled
+    vTaskNotifyGiveFromISR(w->task, &event_worker_woken[cpu]);
+}
+
+// Bottom half that runs the handlers of the ports deferred to this worker
+static void event_worker_task(void * arg)
+{
+    struct event_worker * w = arg;
+    event_action_t * action;
+    xen_ulong_t sel, bits;
+    unsigned int i, word;
+    evtchn_port_t port;
+
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for(i = 0; i < EVTCHN_NR_SEL_WORDS; i++)
+        {
+            sel = xchg(&w->pending_sel[i], 0);
+            while(sel != 0)
+            {
+                word = (i * EVTCHN_WORD_BITS) + __ffs(sel);
+                sel &= sel - 1;
+
+                bits = xchg(&w->pending[word], 0);
+                while(bits != 0)
+                {
+                    port = (word * EVTCHN_WORD_BITS) + __ffs(bits);
+                    bits &= bits - 1;
+
+                    action = get_event_action(port);
+                    if(action != NULL && port == action->port && action->handler != NULL)
+                    {
+                        run_handler(action);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Points the 2-level scan at the vCPU Xen delivers the port to (FIFO queues it there itself)
+static void route_port(evtchn_port_t port, unsigned int vcpu)
+{
+    unsigned int cpu;
+
+    if(port >= EVTCHN_2L_NR_CHANNELS)
+    {
+        return;
+    }
+
+    for(cpu = 0; cpu < XEN_MAX_VCPUS; cpu++)
+    {
+        synch_clear_bit(port, &evtchn_cpu_mask[cpu][0]);
+    }
+    synch_set_bit(port, &evtchn_cpu_mask[vcpu][0]);
+}
+
  /*
  * Force a proper event-channel callback from Xen after clearing the
  * callback mask. We do this in a very simple manner, by making a call
@@ -81,7 +302,13 @@ static void force_evtchn_callback(void)
 		int save;
 	#endif
 		vcpu_info_t *vcpu;
-		vcpu = &shared_info->vcpu_info[smp_processor_id()];
+		unsigned int cpu = smp_processor_id();
+
+		if (cpu >= XEN_MAX_VCPUS || vcpu_info_table[cpu] == NULL)
+		{
+			return;
+		}
+		vcpu = vcpu_info_table[cpu];
 	#ifdef XEN_HAVE_PV_UPCALL_MASK
 		save = vcpu->evtchn_upcall_mask;
 	#endif
@@ -135,17 +362,72 @@ int evtchn_bind_interdomain(domid_t remote_dom, evtchn_port_t remote_port, evtch
     return 0;
 }
 
+// Binds a new local port to a virtual IRQ. Per-vCPU VIRQs such as VIRQ_DEBUG
+// are delivered to the given vCPU; global VIRQs must be bound on vCPU 0 and
+// can be moved with evtchn_bind_vcpu() later. The port starts masked, register
+// a handler for it and unmask it as for any other port.
+int evtchn_bind_virq(uint32_t virq, unsigned int vcpu, evtchn_port_t * port)
+{
+    evtchn_bind_virq_t op;
+
+    if(vcpu >= XEN_MAX_VCPUS || vcpu_info_table[vcpu] == NULL)
+    {
+        return -1;
+    }
+
+    op.virq = virq;
+    op.vcpu = vcpu;
+    if(HYPERVISOR_event_channel_op(EVTCHNOP_bind_virq, &op) != 0)
+    {
+        printk("error executing EVTCHNOP_bind_virq hypercall\r\n");
+        return -1;
+    }
+
+    mask_evtchn(op.port);
+    route_port(op.port, vcpu);
+
+    *port = op.port;
+
+    return 0;
+}
+
 // This function is used to register a callback function for a particular event channel
 int register_event_handler(evtchn_port_t port, evtchn_handler_t handler, void * data)
 {
     event_action_t * action;
+    event_action_t * block;
+    event_action_t * expected = NULL;
 
-    if(port >= MAX_EVTCHN)
+    if(port >= EVTCHN_MAX_PORTS)
     {
         return -1;
     }
 
-    action = &event_action_table[port];
+    action = get_event_action(port);
+    if(action == NULL)
+    {
+        /* First port bound in this word, allocate its block of handlers */
+        block = calloc(EVTCHN_WORD_BITS, sizeof(event_action_t));
+        if(block == NULL)
+        {
+            return -1;
+        }
+
+        if(!__atomic_compare_exchange_n(&event_action_table[port / EVTCHN_WORD_BITS],
+            &expected, block, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            /* Lost a race with another registration in the same word */
+            free(block);
+        }
+
+        action = get_event_action(port);
+    }
+
+    /* With the FIFO ABI the port needs an event word before it can be used */
+    if(evtchn_abi == EVTCHN_ABI_FIFO && evtchn_fifo_setup(port) != 0)
+    {
+        return -1;
+    }
 
 	if(0 != action->port && port != action->port)
 	{
@@ -161,19 +443,86 @@ int register_event_handler(evtchn_port_t port, evtchn_handler_t handler, void *
 
 void unbind_evtchn(evtchn_port_t port)
 {
-    event_action_t * action = &event_action_table[port];
+    event_action_t * action = get_event_action(port);
     struct evtchn_close close;
 
     mask_evtchn(port);
     clear_evtchn(port);
 
-    action->handler = NULL;
-    action->data = NULL;
-    wmb();
-    action->port = 0;
+    if(action != NULL)
+    {
+        action->handler = NULL;
+        action->data = NULL;
+        wmb();
+        action->port = 0;
+        action->deferred = 0;
+    }
 
     close.port = port;
     HYPERVISOR_event_channel_op(EVTCHNOP_close, &close);
+
+    /* Xen hands a reused port out bound to vCPU 0 again */
+    route_port(port, 0);
+}
+
+// Creates a deferred dispatch worker task at the given FreeRTOS priority
+int evtchn_start_worker(unsigned int worker, unsigned int priority, unsigned short stack_depth)
+{
+    struct event_worker * w;
+
+    if(worker >= EVTCHN_NR_WORKERS)
+    {
+        return -1;
+    }
+
+    w = &event_workers[worker];
+    if(w->task != NULL)
+    {
+        return -1;
+    }
+
+    if(stack_depth < EVTCHN_WORKER_STACK_MIN)
+    {
+        stack_depth = EVTCHN_WORKER_STACK_MIN;
+    }
+
+    if(xTaskCreate(event_worker_task, "evtchn", stack_depth, w,
+        (UBaseType_t)priority, &w->task) != pdPASS)
+    {
+        w->task = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Chooses whether a port's handler runs in the IRQ (EVTCHN_DISPATCH_INLINE) or
+// in one of the worker tasks. Call after register_event_handler().
+int evtchn_set_dispatch(evtchn_port_t port, int worker)
+{
+    event_action_t * action = get_event_action(port);
+
+    if(action == NULL || action->port != port)
+    {
+        return -1;
+    }
+
+    if(worker == EVTCHN_DISPATCH_INLINE)
+    {
+        action->deferred = 0;
+        return 0;
+    }
+
+    if(worker < 0 || worker >= EVTCHN_NR_WORKERS || event_workers[worker].task == NULL)
+    {
+        return -1;
+    }
+
+    action->worker = worker;
+    wmb();
+    action->deferred = 1;
+
+    return 0;
 }
 
 // This function is used by the guest to notify Xen that an event has occurred
@@ -183,9 +532,90 @@ void notify_evtch(evtchn_port_t port)
     HYPERVISOR_event_channel_op(EVTCHNOP_send, &op);
 }
 
+// Sets the priority Xen queues the port's events at. Only the FIFO ABI has
+// priorities, call this after binding and before unmasking the port.
+int evtchn_set_priority(evtchn_port_t port, unsigned int priority)
+{
+    if(evtchn_abi != EVTCHN_ABI_FIFO)
+    {
+        return -1;
+    }
+
+    return evtchn_fifo_set_priority(port, priority);
+}
+
+// Moves delivery of a port's events to another vCPU, which must have
+// registered its vcpu_info first
+int evtchn_bind_vcpu(evtchn_port_t port, unsigned int vcpu)
+{
+    evtchn_bind_vcpu_t op;
+
+    if(vcpu >= XEN_MAX_VCPUS || vcpu_info_table[vcpu] == NULL)
+    {
+        return -1;
+    }
+
+    op.port = port;
+    op.vcpu = vcpu;
+    if(HYPERVISOR_event_channel_op(EVTCHNOP_bind_vcpu, &op) != 0)
+    {
+        printk("error executing EVTCHNOP_bind_vcpu hypercall\r\n");
+        return -1;
+    }
+
+    route_port(port, vcpu);
+
+    return 0;
+}
+
+// Gives a vCPU its own vcpu_info so it can take event upcalls. vCPU 0 works
+// without this, every other vCPU needs it before ports are bound to it.
+int evtchn_register_vcpu_info(unsigned int vcpu)
+{
+    vcpu_register_vcpu_info_t info;
+    vcpu_info_t * area;
+
+    if(vcpu >= XEN_MAX_VCPUS)
+    {
+        return -1;
+    }
+
+    area = &vcpu_info_area[vcpu].info;
+    if(vcpu_info_table[vcpu] == area)
+    {
+        return 0;
+    }
+
+    info.mfn    = VA_TO_GUEST_PAGE(area);
+    info.offset = (u64)area & ~PAGE_MASK;
+    info.rsvd   = 0;
+    if(HYPERVISOR_vcpu_op(VCPUOP_register_vcpu_info, vcpu, &info) != 0)
+    {
+        printk("error executing VCPUOP_register_vcpu_info hypercall\r\n");
+        return -1;
+    }
+
+    vcpu_info_table[vcpu] = area;
+
+    /* The FIFO ABI keeps a separate set of queues for each vCPU */
+    if(evtchn_abi == EVTCHN_ABI_FIFO && evtchn_fifo_init_vcpu(vcpu) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
 inline void mask_evtchn(evtchn_port_t port)
 {
     struct shared_info* s = shared_info;
+
+    if(evtchn_abi == EVTCHN_ABI_FIFO)
+    {
+        evtchn_fifo_mask(port);
+        return;
+    }
+
     synch_set_bit(port, &s->evtchn_mask[0]);
 }
 
@@ -193,10 +623,31 @@ inline void mask_evtchn(evtchn_port_t port)
 inline void unmask_evtchn(evtchn_port_t port)
 {
 	struct shared_info* s = shared_info;
-    vcpu_info_t *vcpu_info = &s->vcpu_info[0];
+    unsigned int cpu = smp_processor_id();
+    vcpu_info_t *vcpu_info;
+    evtchn_unmask_t op;
+
+    if(evtchn_abi == EVTCHN_ABI_FIFO)
+    {
+        evtchn_fifo_unmask(port);
+        return;
+    }
 
     synch_clear_bit(port, &s->evtchn_mask[0]);
 
+    /* Only the vCPU the port is bound to can resend the event locally, a vCPU
+     * beyond XEN_MAX_VCPUS has no vcpu_info of its own and leaves it to Xen */
+    vcpu_info = cpu < XEN_MAX_VCPUS ? vcpu_info_table[cpu] : NULL;
+    if (vcpu_info == NULL || !synch_test_bit(port, &evtchn_cpu_mask[cpu][0]))
+    {
+        if (synch_test_bit(port, &s->evtchn_pending[0]))
+        {
+            op.port = port;
+            HYPERVISOR_event_channel_op(EVTCHNOP_unmask, &op);
+        }
+        return;
+    }
+
     /*
      * The following is basically the equivalent of 'hw_resend_irq'. Just like
      * a real IO-APIC we 'lose the interrupt edge' if the channel is masked.s
@@ -217,42 +668,289 @@ inline void unmask_evtchn(evtchn_port_t port)
 inline void clear_evtchn(evtchn_port_t port)
 {
     shared_info_t *s = shared_info;
+
+    if(evtchn_abi == EVTCHN_ABI_FIFO)
+    {
+        evtchn_fifo_clear(port);
+        return;
+    }
+
     synch_clear_bit(port, &s->evtchn_pending[0]);
 }
 
+// Returns non-zero if the port has an event waiting, masked or not
+int evtchn_is_pending(evtchn_port_t port)
+{
+    if(evtchn_abi == EVTCHN_ABI_FIFO)
+    {
+        return evtchn_fifo_is_pending(port);
+    }
+
+    return synch_test_bit(port, &shared_info->evtchn_pending[0]);
+}
+
+// Clears and returns the first pending port in the set, or -1 if none are
+static int evtchn_take_pending(const evtchn_port_t * ports, unsigned int nr_ports)
+{
+    unsigned int i;
+
+    for(i = 0; i < nr_ports; i++)
+    {
+        if(evtchn_is_pending(ports[i]))
+        {
+            clear_evtchn(ports[i]);
+            return ports[i];
+        }
+    }
+
+    return -1;
+}
+
+// Converts a virtual counter value to nanoseconds without overflowing
+static u64 cntvct_to_ns(u64 ticks)
+{
+    u64 freq = read_cntfrq();
+
+    return (ticks / freq) * 1000000000ULL + ((ticks % freq) * 1000000000ULL) / freq;
+}
+
+// Waits for one of the ports to fire without going through the event IRQ. The
+// pending bits are polled for spin_ticks CNTVCT ticks, then the vCPU is handed
+// back to Xen with SCHEDOP_poll until a port is pending or timeout CNTVCT ticks
+// have passed since the call (EVTCHN_WAIT_FOREVER to wait without limit). The
+// guest cannot read Xen's system time, so the deadline Xen is given is the
+// virtual counter in nanoseconds, which only approximates it. The deadline is
+// therefore also checked on the counter each time the poll returns, and a poll
+// that comes back early is repeated without one, woken by the FreeRTOS tick at
+// least once per tick. The ports should be masked so the event is not also
+// delivered to handle_event_irq(). Returns the port that fired, after clearing
+// it, or -1 on timeout or error.
+int evtchn_wait(const evtchn_port_t * ports, unsigned int nr_ports, u64 spin_ticks, u64 timeout)
+{
+    sched_poll_t poll;
+    u64 start;
+    int port;
+    int ret;
+
+    if(ports == NULL || nr_ports == 0)
+    {
+        return -1;
+    }
+
+    start = read_cntvct();
+    do
+    {
+        port = evtchn_take_pending(ports, nr_ports);
+        if(port >= 0)
+        {
+            return port;
+        }
+    } while((read_cntvct() - start) < spin_ticks);
+
+    set_xen_guest_handle(poll.ports, (evtchn_port_t *)ports);
+    poll.nr_ports = nr_ports;
+    poll.timeout = (timeout != EVTCHN_WAIT_FOREVER) ? cntvct_to_ns(start + timeout) : 0;
+
+    for(;;)
+    {
+        if(timeout != EVTCHN_WAIT_FOREVER && (read_cntvct() - start) >= timeout)
+        {
+            return -1;
+        }
+
+        ret = HYPERVISOR_sched_op(SCHEDOP_poll, &poll);
+        if(ret < 0)
+        {
+            printk("error executing SCHEDOP_poll hypercall\r\n");
+            return -1;
+        }
+
+        /* Wakeups for other interrupts only recheck the time left */
+        port = evtchn_take_pending(ports, nr_ports);
+        if(port >= 0)
+        {
+            return port;
+        }
+
+        /* Xen's clock may already be past the deadline, do not spin on it */
+        poll.timeout = 0;
+    }
+}
+
 // The IRQ handler for the interrupt that Xen uses for events (IRQ 31).
 void handle_event_irq(void* data)
 {
 	unsigned long  l1, l2, l1i, l2i;
 	unsigned int   port;
-	int            cpu = 0;
+	unsigned int   cpu = smp_processor_id();
+	int            handled = 0;
+	BaseType_t     woken;
 	shared_info_t *s = shared_info;
-	vcpu_info_t   *vcpu_info = &s->vcpu_info[cpu];
+	vcpu_info_t   *vcpu_info;
+
+	if(cpu >= XEN_MAX_VCPUS || vcpu_info_table[cpu] == NULL)
+	{
+		return;
+	}
+	vcpu_info = vcpu_info_table[cpu];
 
 	vcpu_info->evtchn_upcall_pending = 0;
 	wmb();
 
-	l1 = xchg(&vcpu_info->evtchn_pending_sel, 0);
-	while ( l1 != 0 )
+#if XEN_EVTCHN_STATS
+	__atomic_fetch_add(&evtchn_irq_stats.irqs, 1, __ATOMIC_RELAXED);
+#endif
+
+	if(evtchn_abi == EVTCHN_ABI_FIFO)
+	{
+		evtchn_fifo_handle_events(do_event);
+		handled = 1;
+	}
+	else
 	{
-		l1i = __ffs(l1);
-		l1 &= ~(1UL << l1i);
-		while ( (l2 = active_evtchns(cpu, s, l1i)) != 0 )
+		l1 = xchg(&vcpu_info->evtchn_pending_sel, 0);
+		while ( l1 != 0 )
 		{
-			l2i = __ffs(l2);
-			l2 &= ~(1UL << l2i);
+			l1i = __ffs(l1);
+			l1 &= ~(1UL << l1i);
+#if XEN_EVTCHN_STATS
+			l2 = s->evtchn_pending[l1i] & evtchn_cpu_mask[cpu][l1i] & s->evtchn_mask[l1i];
+			while ( l2 != 0 )
+			{
+				evtchn_stats_note_masked((l1i * EVTCHN_WORD_BITS) + __ffs(l2));
+				l2 &= l2 - 1;
+			}
+#endif
+			while ( (l2 = active_evtchns(cpu, s, l1i)) != 0 )
+			{
+				l2i = __ffs(l2);
+				l2 &= ~(1UL << l2i);
 
-			port = (l1i * (sizeof(unsigned long) * 8)) + l2i;
-			do_event(port);
+				port = (l1i * (sizeof(unsigned long) * 8)) + l2i;
+				handled |= do_event(port);
 
+			}
 		}
 	}
+
+#if XEN_EVTCHN_STATS
+	if(!handled)
+	{
+		__atomic_fetch_add(&evtchn_irq_stats.spurious_irqs, 1, __ATOMIC_RELAXED);
+	}
+#else
+	(void)handled;
+#endif
+
+	// Switch straight to a worker task that was woken if it outranks the current task
+	if(xen_in_isr())
+	{
+		woken = event_worker_woken[cpu];
+		event_worker_woken[cpu] = pdFALSE;
+		portYIELD_FROM_ISR(woken);
+	}
+	else if(xen_can_block())
+	{
+		taskYIELD();
+	}
+}
+
+#if XEN_EVTCHN_STATS
+// Counts a port that a scan found pending while it was masked
+void evtchn_stats_note_masked(evtchn_port_t port)
+{
+    event_action_t * action = get_event_action(port);
+
+    if(action != NULL)
+    {
+        __atomic_fetch_add(&action->stats.masked_pending, 1, __ATOMIC_RELAXED);
+    }
+}
+#endif
+
+// Copies the port's counters. Returns -1 if statistics are compiled out or the
+// port never had a handler.
+int evtchn_stats_snapshot(evtchn_port_t port, evtchn_stats_t * stats)
+{
+#if XEN_EVTCHN_STATS
+    event_action_t * action = get_event_action(port);
+
+    if(action == NULL || stats == NULL)
+    {
+        return -1;
+    }
+
+    memcpy(stats, &action->stats, sizeof(*stats));
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int evtchn_stats_reset(evtchn_port_t port)
+{
+#if XEN_EVTCHN_STATS
+    event_action_t * action = get_event_action(port);
+
+    if(action == NULL)
+    {
+        return -1;
+    }
+
+    memset(&action->stats, 0, sizeof(action->stats));
+
+    return 0;
+#else
+    return -1;
+#endif
 }
 
-// Initialize the guest's event framework
+int evtchn_irq_stats_snapshot(evtchn_irq_stats_t * stats)
+{
+#if XEN_EVTCHN_STATS
+    if(stats == NULL)
+    {
+        return -1;
+    }
+
+    memcpy(stats, &evtchn_irq_stats, sizeof(*stats));
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int evtchn_irq_stats_reset(void)
+{
+#if XEN_EVTCHN_STATS
+    memset(&evtchn_irq_stats, 0, sizeof(evtchn_irq_stats));
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+// Initialize the guest's event framework with the 2-level ABI
 void init_events(void)
+{
+    init_events_abi(EVTCHN_ABI_2L);
+}
+
+// Initialize the guest's event framework with the requested ABI. Must be called
+// before init_console() or any other driver, which otherwise select the 2-level
+// ABI. Falls back to the 2-level ABI if Xen refuses the FIFO ABI.
+int init_events_abi(int abi)
 {
     xen_add_to_physmap_t xatp;
+    int ret;
+
+    if(events_initialised)
+    {
+        return (evtchn_abi == abi) ? 0 : -1;
+    }
 
     /* Map shared_info page */
     xatp.domid = DOMID_SELF;
@@ -266,5 +964,29 @@ void init_events(void)
     }
 
     shared_info = (struct shared_info *)shared_info_page;
+    vcpu_info_table[0] = &shared_info->vcpu_info[0];
+    memset(evtchn_cpu_mask[0], 0xff, sizeof(evtchn_cpu_mask[0]));
+    events_initialised = 1;
+
+    if(abi == EVTCHN_ABI_FIFO)
+    {
+        ret = evtchn_fifo_init();
+        if(ret == EVTCHN_FIFO_UNAVAILABLE)
+        {
+            printk("FIFO event channel ABI unavailable, using 2-level ABI\r\n");
+            return -1;
+        }
+
+        /* Xen queues events FIFO style from here on, even if the array could
+         * not be set up yet; binding a port tries to add it again */
+        evtchn_abi = EVTCHN_ABI_FIFO;
+        if(ret != 0)
+        {
+            printk("FIFO event channel ABI has no event array\r\n");
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
@@ -23,14 +23,76 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define EVENT_IRQ	31
 
+// Ports at or above this cannot have a handler. Covers the whole 2-level ABI.
+#ifndef EVTCHN_MAX_PORTS
+#define EVTCHN_MAX_PORTS	EVTCHN_2L_NR_CHANNELS
+#endif
+
+// Number of vCPUs whose events this library can dispatch
+#ifndef XEN_MAX_VCPUS
+#define XEN_MAX_VCPUS		4
+#endif
+
+// Event channel ABIs that init_events_abi() can select
+#define EVTCHN_ABI_2L		0
+#define EVTCHN_ABI_FIFO		1
+
+// Number of deferred dispatch worker tasks that evtchn_start_worker() can create
+#ifndef EVTCHN_NR_WORKERS
+#define EVTCHN_NR_WORKERS	2
+#endif
+
+// Run the port's handler directly in handle_event_irq()
+#define EVTCHN_DISPATCH_INLINE	(-1)
+
+// evtchn_wait() timeout that blocks until a port fires
+#define EVTCHN_WAIT_FOREVER		0
+
+// Per-port dispatch counters and handler timing. Off by default, in which case
+// none of it is compiled into the IRQ path and the stats calls return -1.
+#ifndef XEN_EVTCHN_STATS
+#define XEN_EVTCHN_STATS	0
+#endif
+
+#define EVTCHN_STATS_HIST_BUCKETS	16
+
 typedef void (*evtchn_handler_t)(void * data);
 
+typedef struct evtchn_stats
+{
+	u32 dispatched;		// handler runs, inline or deferred
+	u32 spurious;		// pending with no handler registered
+	u32 masked_pending;	// seen pending while masked during a scan
+	u64 duration_max;	// longest handler run, in CNTVCT ticks
+	// Handler run times: bucket n counts runs of [2^n, 2^(n+1)) CNTVCT
+	// ticks, the first bucket also counts 0 and the last everything longer
+	u32 duration_hist[EVTCHN_STATS_HIST_BUCKETS];
+} evtchn_stats_t;
+
+typedef struct evtchn_irq_stats
+{
+	u32 irqs;			// calls to handle_event_irq()
+	u32 spurious_irqs;	// calls that dispatched no port, either none was
+						// pending or none of those pending had a handler
+	u32 unbound;		// events on ports that have no handler slot
+} evtchn_irq_stats_t;
+
 int evtchn_alloc_ubound(domid_t remote_dom, evtchn_port_t * remote_port);
 int evtchn_bind_interdomain(domid_t remote_dom, evtchn_port_t remote_port, evtchn_port_t * local_port);
+int evtchn_bind_virq(uint32_t virq, unsigned int vcpu, evtchn_port_t * port);
 int register_event_handler(evtchn_port_t evtch_id, evtchn_handler_t fptr, void * data);
 void unbind_evtchn(evtchn_port_t port);
 
+int evtchn_start_worker(unsigned int worker, unsigned int priority, unsigned short stack_depth);
+int evtchn_set_dispatch(evtchn_port_t port, int worker);
+
 void notify_evtch(evtchn_port_t evtch_id);
+int evtchn_is_pending(evtchn_port_t port);
+int evtchn_wait(const evtchn_port_t * ports, unsigned int nr_ports, u64 spin_ticks, u64 timeout);
+
+int evtchn_set_priority(evtchn_port_t port, unsigned int priority);
+int evtchn_bind_vcpu(evtchn_port_t port, unsigned int vcpu);
+int evtchn_register_vcpu_info(unsigned int vcpu);
 
 void mask_evtchn(evtchn_port_t port);
 void unmask_evtchn(evtchn_port_t port);
@@ -38,7 +100,13 @@ void clear_evtchn(evtchn_port_t port);
 
 void handle_event_irq(void* data);
 
+int evtchn_stats_snapshot(evtchn_port_t port, evtchn_stats_t * stats);
+int evtchn_stats_reset(evtchn_port_t port);
+int evtchn_irq_stats_snapshot(evtchn_irq_stats_t * stats);
+int evtchn_irq_stats_reset(void);
+
 void init_events(void);
+int init_events_abi(int abi);
 
 
 #endif /* _XEN_EVENTS_H_ */
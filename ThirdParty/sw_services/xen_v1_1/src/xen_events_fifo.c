@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/******** Includes ************************************************************/
+#include "xen_events_fifo.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm64_ops.h"
+#include "hypercall.h"
+#include "mm.h"
+#include "xen_console.h"
+#include "xen_events.h"
+#include "xen/xen.h"
+#include "xen/event_channel.h"
+
+
+/******** Definitions *********************************************************/
+#define EVENT_WORDS_PER_PAGE    (PAGE_SIZE / sizeof(event_word_t))
+#define MAX_EVENT_ARRAY_PAGES   ((EVTCHN_MAX_PORTS + EVENT_WORDS_PER_PAGE - 1) / EVENT_WORDS_PER_PAGE)
+
+/* Every vCPU's control block lives in the same page, at its own offset */
+#define CONTROL_BLOCK_STRIDE    128
+
+
+/******** Function Prototypes *************************************************/
+static volatile event_word_t * event_word_from_port(evtchn_port_t port);
+static event_word_t clear_linked(volatile event_word_t * word);
+static void consume_one_event(unsigned int cpu, unsigned int priority,
+    uint32_t * ready, evtchn_dispatch_t dispatch);
+static int expand_array(event_word_t * page);
+
+
+/******** Module Variables ****************************************************/
+static __attribute__((aligned(0x1000))) u8 control_block_page[PAGE_SIZE];
+
+static evtchn_fifo_control_block_t * control_block[XEN_MAX_VCPUS];
+static event_word_t *                event_array[MAX_EVENT_ARRAY_PAGES];
+static unsigned int                  event_array_pages = 0;
+
+/* Local copy of the queue heads, so a queue is only re-read from the control
+ * block once the guest has consumed up to its tail */
+static uint32_t                      queue_head[XEN_MAX_VCPUS][EVTCHN_FIFO_MAX_QUEUES];
+
+
+/******** Private Functions ***************************************************/
+static volatile event_word_t * event_word_from_port(evtchn_port_t port)
+{
+    unsigned int page = port / EVENT_WORDS_PER_PAGE;
+
+    if(page >= event_array_pages)
+    {
+        return NULL;
+    }
+
+    return &event_array[page][port % EVENT_WORDS_PER_PAGE];
+}
+
+static event_word_t clear_linked(volatile event_word_t * word)
+{
+    event_word_t old = *word;
+    event_word_t new;
+
+    do
+    {
+        new = old & ~((1 << EVTCHN_FIFO_LINKED) | EVTCHN_FIFO_LINK_MASK);
+    } while(!__atomic_compare_exchange_n(word, &old, new, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    return old & EVTCHN_FIFO_LINK_MASK;
+}
+
+static void consume_one_event(unsigned int cpu, unsigned int priority,
+    uint32_t * ready, evtchn_dispatch_t dispatch)
+{
+    volatile event_word_t * word;
+    evtchn_port_t port;
+    uint32_t head;
+
+    head = queue_head[cpu][priority];
+
+    /* Reached the tail last time, read the new head from the control block */
+    if(head == 0)
+    {
+        rmb();
+        head = control_block[cpu]->head[priority];
+    }
+
+    port = head;
+    word = event_word_from_port(port);
+    if(word == NULL)
+    {
+        /* Xen linked a port we never gave it an array page for */
+        *ready &= ~(1U << priority);
+        queue_head[cpu][priority] = 0;
+        return;
+    }
+
+    /* A zero link means this was the last event in the queue */
+    head = clear_linked(word);
+    if(head == 0)
+    {
+        *ready &= ~(1U << priority);
+    }
+
+    if(synch_test_bit(EVTCHN_FIFO_PENDING, word))
+    {
+        if(!synch_test_bit(EVTCHN_FIFO_MASKED, word))
+        {
+            dispatch(port);
+        }
+#if XEN_EVTCHN_STATS
+        else
+        {
+            evtchn_stats_note_masked(port);
+        }
+#endif
+    }
+
+    queue_head[cpu][priority] = head;
+}
+
+// Fills a new array page with masked ports and hands it to Xen
+static int expand_array(event_word_t * page)
+{
+    evtchn_expand_array_t expand;
+    unsigned int index;
+
+    /* New ports start masked, the same as they would with the 2-level ABI */
+    for(index = 0; index < EVENT_WORDS_PER_PAGE; index++)
+    {
+        page[index] = 1 << EVTCHN_FIFO_MASKED;
+    }
+
+    expand.array_gfn = VA_TO_GUEST_PAGE(page);
+    if(HYPERVISOR_event_channel_op(EVTCHNOP_expand_array, &expand) != 0)
+    {
+        printk("error executing EVTCHNOP_expand_array hypercall\r\n");
+        return -1;
+    }
+
+    event_array[event_array_pages] = page;
+    wmb();
+    event_array_pages++;
+
+    return 0;
+}
+
+
+/******** Public Functions ****************************************************/
+// Switches the domain to the FIFO ABI. Once EVTCHNOP_init_control succeeds
+// there is no way back, so only a refusal of that leaves the 2-level ABI in use.
+int evtchn_fifo_init(void)
+{
+    event_word_t * page;
+
+    memset(control_block_page, 0, sizeof(control_block_page));
+    memset(queue_head, 0, sizeof(queue_head));
+
+    /* Xen needs at least one array page before any event can be queued, so
+     * it is allocated while falling back is still possible */
+    page = valloc(PAGE_SIZE);
+    if(page == NULL)
+    {
+        return EVTCHN_FIFO_UNAVAILABLE;
+    }
+
+    /* vCPU 0 switches the domain over, the others join through
+     * evtchn_register_vcpu_info() */
+    if(evtchn_fifo_init_vcpu(0) != 0)
+    {
+        free(page);
+        return EVTCHN_FIFO_UNAVAILABLE;
+    }
+
+    if(expand_array(page) != 0)
+    {
+        free(page);
+        return EVTCHN_FIFO_NO_ARRAY;
+    }
+
+    return 0;
+}
+
+int evtchn_fifo_init_vcpu(unsigned int vcpu)
+{
+    evtchn_init_control_t init_control;
+    u32 offset = vcpu * CONTROL_BLOCK_STRIDE;
+
+    if(vcpu >= XEN_MAX_VCPUS || offset + sizeof(evtchn_fifo_control_block_t) > PAGE_SIZE)
+    {
+        return -1;
+    }
+
+    init_control.control_gfn = VA_TO_GUEST_PAGE(control_block_page);
+    init_control.offset      = offset;
+    init_control.vcpu        = vcpu;
+
+    if(HYPERVISOR_event_channel_op(EVTCHNOP_init_control, &init_control) != 0)
+    {
+        printk("error executing EVTCHNOP_init_control hypercall\r\n");
+        return -1;
+    }
+
+    control_block[vcpu] = (evtchn_fifo_control_block_t *)&control_block_page[offset];
+
+    return 0;
+}
+
+// Grows the event array until it covers the port
+int evtchn_fifo_setup(evtchn_port_t port)
+{
+    event_word_t * page;
+
+    if(port >= EVTCHN_MAX_PORTS)
+    {
+        return -1;
+    }
+
+    while(port / EVENT_WORDS_PER_PAGE >= event_array_pages)
+    {
+        page = valloc(PAGE_SIZE);
+        if(page == NULL)
+        {
+            return -1;
+        }
+
+        if(expand_array(page) != 0)
+        {
+            free(page);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int evtchn_fifo_set_priority(evtchn_port_t port, unsigned int priority)
+{
+    evtchn_set_priority_t op;
+
+    if(priority > EVTCHN_FIFO_PRIORITY_MIN)
+    {
+        return -1;
+    }
+
+    op.port     = port;
+    op.priority = priority;
+    if(HYPERVISOR_event_channel_op(EVTCHNOP_set_priority, &op) != 0)
+    {
+        printk("error executing EVTCHNOP_set_priority hypercall\r\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void evtchn_fifo_mask(evtchn_port_t port)
+{
+    volatile event_word_t * word = event_word_from_port(port);
+
+    if(word != NULL)
+    {
+        synch_set_bit(EVTCHN_FIFO_MASKED, word);
+    }
+}
+
+void evtchn_fifo_unmask(evtchn_port_t port)
+{
+    volatile event_word_t * word = event_word_from_port(port);
+    evtchn_unmask_t unmask;
+
+    if(word == NULL)
+    {
+        return;
+    }
+
+    synch_clear_bit(EVTCHN_FIFO_MASKED, word);
+
+    /* Xen does not requeue an event that became pending while masked */
+    if(synch_test_bit(EVTCHN_FIFO_PENDING, word))
+    {
+        unmask.port = port;
+        HYPERVISOR_event_channel_op(EVTCHNOP_unmask, &unmask);
+    }
+}
+
+void evtchn_fifo_clear(evtchn_port_t port)
+{
+    volatile event_word_t * word = event_word_from_port(port);
+
+    if(word != NULL)
+    {
+        synch_clear_bit(EVTCHN_FIFO_PENDING, word);
+    }
+}
+
+int evtchn_fifo_is_pending(evtchn_port_t port)
+{
+    volatile event_word_t * word = event_word_from_port(port);
+
+    if(word == NULL)
+    {
+        return 0;
+    }
+
+    return synch_test_bit(EVTCHN_FIFO_PENDING, word);
+}
+
+// Consumes queued events, always servicing the highest priority ready queue first
+void evtchn_fifo_handle_events(evtchn_dispatch_t dispatch)
+{
+    unsigned int cpu = smp_processor_id();
+    evtchn_fifo_control_block_t * cb;
+    uint32_t ready;
+
+    if(cpu >= XEN_MAX_VCPUS || control_block[cpu] == NULL)
+    {
+        return;
+    }
+    cb = control_block[cpu];
+
+    ready = xchg(&cb->ready, 0);
+    while(ready != 0)
+    {
+        consume_one_event(cpu, __ffs(ready), &ready, dispatch);
+
+        /* Pick up queues that became ready while dispatching */
+        ready |= xchg(&cb->ready, 0);
+    }
+}
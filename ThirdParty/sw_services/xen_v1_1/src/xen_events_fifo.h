@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _XEN_EVENTS_FIFO_H_
+#define _XEN_EVENTS_FIFO_H_
+
+/******** Includes ************************************************************/
+#include "types.h"
+#include "xen/event_channel.h"
+#include "xen_events.h"
+
+
+/******** Definitions *********************************************************/
+typedef int (*evtchn_dispatch_t)(evtchn_port_t port);
+
+// evtchn_fifo_init() results besides 0
+#define EVTCHN_FIFO_UNAVAILABLE	(-1)	// Xen refused, the 2-level ABI stays in use
+#define EVTCHN_FIFO_NO_ARRAY	(-2)	// switched to FIFO, but without an event array page
+
+
+/******** Public Functions ****************************************************/
+int  evtchn_fifo_init(void);
+int  evtchn_fifo_init_vcpu(unsigned int vcpu);
+int  evtchn_fifo_setup(evtchn_port_t port);
+int  evtchn_fifo_set_priority(evtchn_port_t port, unsigned int priority);
+
+void evtchn_fifo_mask(evtchn_port_t port);
+void evtchn_fifo_unmask(evtchn_port_t port);
+void evtchn_fifo_clear(evtchn_port_t port);
+int  evtchn_fifo_is_pending(evtchn_port_t port);
+
+void evtchn_fifo_handle_events(evtchn_dispatch_t dispatch);
+
+#if XEN_EVTCHN_STATS
+/* Provided by xen_events.c */
+void evtchn_stats_note_masked(evtchn_port_t port);
+#endif
+
+
+#endif /* _XEN_EVENTS_FIFO_H_ */
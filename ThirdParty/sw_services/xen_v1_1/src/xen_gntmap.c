@@ -18,46 +18,312 @@
 /******** Includes ************************************************************/
 #include "xen_gntmap.h"
 
+#include "arm64_ops.h"
 #include "hypercall.h"
+#include "mm.h"
 #include "xen_console.h"
 #include "xen/xen.h"
 #include "xen/grant_table.h"
 
 
 /******** Definitions *********************************************************/
+/* Operations submitted per hypercall */
+#ifndef GNTMAP_BATCH
+#define GNTMAP_BATCH        16
+#endif
+
+/* A mapped page, or one being mapped while mapped is still 0 */
+struct gntmap_entry
+{
+    unsigned long  host_addr;
+    grant_handle_t handle;
+    int            in_use;
+    int            mapped;
+};
 
 
 /******** Function Prototypes *************************************************/
+static struct gntmap_entry * claim_entry(unsigned long host_addr);
+static struct gntmap_entry * take_mapped_entry(unsigned long host_addr);
+static void release_entry(struct gntmap_entry * entry);
 
 
 /******** Module Variables ****************************************************/
+static struct gntmap_entry gntmap_entries[GNTMAP_MAX_ENTRIES];
 
 
 /******** Private Functions ***************************************************/
+/* Takes a free entry for host_addr, NULL if full or host_addr is in use */
+static struct gntmap_entry * claim_entry(unsigned long host_addr)
+{
+    struct gntmap_entry * entry = NULL;
+    int i;
+
+    local_irq_disable();
+
+    for(i = 0; i < GNTMAP_MAX_ENTRIES; i++)
+    {
+        if(gntmap_entries[i].in_use && gntmap_entries[i].host_addr == host_addr)
+        {
+            entry = NULL;
+            break;
+        }
+
+        if(entry == NULL && !gntmap_entries[i].in_use)
+        {
+            entry = &gntmap_entries[i];
+        }
+    }
+
+    if(entry)
+    {
+        entry->host_addr = host_addr;
+        entry->mapped = 0;
+        entry->in_use = 1;
+    }
+
+    local_irq_enable();
+
+    return entry;
+}
+
+/* Finds the mapped page at host_addr and marks it as being unmapped, so two
+ * callers cannot unmap it at once */
+static struct gntmap_entry * take_mapped_entry(unsigned long host_addr)
+{
+    struct gntmap_entry * entry = NULL;
+    int i;
+
+    local_irq_disable();
+
+    for(i = 0; i < GNTMAP_MAX_ENTRIES; i++)
+    {
+        if(gntmap_entries[i].in_use && gntmap_entries[i].mapped &&
+           gntmap_entries[i].host_addr == host_addr)
+        {
+            entry = &gntmap_entries[i];
+            entry->mapped = 0;
+            break;
+        }
+    }
+
+    local_irq_enable();
+
+    return entry;
+}
+
+static void release_entry(struct gntmap_entry * entry)
+{
+    local_irq_disable();
+    entry->mapped = 0;
+    entry->in_use = 0;
+    local_irq_enable();
+}
 
 
 /******** Public Functions ****************************************************/
 int gntmap_map_grant_ref(unsigned long host_addr, uint32_t domid, uint32_t ref,
     int writeable)
 {
-    struct gnttab_map_grant_ref op;
-    int status;
+    grant_ref_t gref = (grant_ref_t) ref;
 
-    op.ref = (grant_ref_t) ref;
-    op.dom = (domid_t) domid;
-    op.host_addr = (uint64_t) host_addr;
-    op.flags = GNTMAP_host_map;
-    if(!writeable)
+    return gntmap_map_grant_refs(host_addr, domid, &gref, 1, writeable, NULL);
+}
+
+int gntmap_unmap_grant_ref(unsigned long host_addr)
+{
+    return gntmap_unmap_grant_refs(host_addr, 1, NULL);
+}
+
+/*
+ * Maps count pages granted by domid to consecutive pages from host_addr,
+ * submitting up to GNTMAP_BATCH of them per hypercall. status, if not NULL,
+ * receives the GNTST_* result of each page. Returns 0 if all pages were
+ * mapped, -1 otherwise; the pages that did map stay mapped until unmapped.
+ */
+int gntmap_map_grant_refs(unsigned long host_addr, uint32_t domid,
+    const grant_ref_t * refs, size_t count, int writeable, int16_t * status)
+{
+    struct gnttab_map_grant_ref op[GNTMAP_BATCH];
+    struct gntmap_entry *       entry[GNTMAP_BATCH];
+    size_t                      done;
+    size_t                      nr;
+    size_t                      i;
+    unsigned int                nr_ops;
+    int                         call_failed;
+    int                         retval = 0;
+
+    for(done = 0; done < count; done += nr)
     {
-        op.flags |= GNTMAP_readonly;
+        nr = count - done;
+        if(nr > GNTMAP_BATCH)
+        {
+            nr = GNTMAP_BATCH;
+        }
+
+        nr_ops = 0;
+        for(i = 0; i < nr; i++)
+        {
+            entry[i] = claim_entry(host_addr + (done + i) * PAGE_SIZE);
+            if(entry[i] == NULL)
+            {
+                printk("error mapping grant ref %u: address in use or no free entry\r\n",
+                    (unsigned int) refs[done + i]);
+                if(status)
+                {
+                    status[done + i] = GNTST_bad_virt_addr;
+                }
+                retval = -1;
+                continue;
+            }
+
+            op[nr_ops].ref = refs[done + i];
+            op[nr_ops].dom = (domid_t) domid;
+            op[nr_ops].host_addr = (uint64_t) entry[i]->host_addr;
+            op[nr_ops].flags = GNTMAP_host_map;
+            if(!writeable)
+            {
+                op[nr_ops].flags |= GNTMAP_readonly;
+            }
+            nr_ops++;
+        }
+
+        call_failed = nr_ops && HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, op, nr_ops);
+        if(call_failed)
+        {
+            printk("error executing GNTTABOP_map_grant_ref hypercall\r\n");
+            for(i = 0; i < nr_ops; i++)
+            {
+                op[i].status = GNTST_general_error;
+            }
+        }
+
+        nr_ops = 0;
+        for(i = 0; i < nr; i++)
+        {
+            if(entry[i] == NULL)
+            {
+                continue;
+            }
+
+            if(status)
+            {
+                status[done + i] = op[nr_ops].status;
+            }
+
+            if(op[nr_ops].status == GNTST_okay)
+            {
+                local_irq_disable();
+                entry[i]->handle = op[nr_ops].handle;
+                entry[i]->mapped = 1;
+                local_irq_enable();
+            }
+            else
+            {
+                if(!call_failed)
+                {
+                    printk("error mapping grant ref %u: status %d\r\n",
+                        (unsigned int) refs[done + i], op[nr_ops].status);
+                }
+                release_entry(entry[i]);
+                retval = -1;
+            }
+            nr_ops++;
+        }
     }
 
-    status = HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, &op, 1);
-    if(status || op.status != GNTST_okay)
+    return retval;
+}
+
+/*
+ * Unmaps count consecutive pages from host_addr that were mapped with
+ * gntmap_map_grant_refs(), in batches of GNTMAP_BATCH. status, if not NULL,
+ * receives the GNTST_* result of each page. Returns 0 if all pages were
+ * unmapped, -1 otherwise.
+ */
+int gntmap_unmap_grant_refs(unsigned long host_addr, size_t count,
+    int16_t * status)
+{
+    struct gnttab_unmap_grant_ref op[GNTMAP_BATCH];
+    struct gntmap_entry *         entry[GNTMAP_BATCH];
+    size_t                        done;
+    size_t                        nr;
+    size_t                        i;
+    unsigned int                  nr_ops;
+    int                           call_failed;
+    int                           retval = 0;
+
+    for(done = 0; done < count; done += nr)
     {
-        printk("error executing GNTTABOP_map_grant_ref hypercall\r\n");
-        return -1;
+        nr = count - done;
+        if(nr > GNTMAP_BATCH)
+        {
+            nr = GNTMAP_BATCH;
+        }
+
+        nr_ops = 0;
+        for(i = 0; i < nr; i++)
+        {
+            entry[i] = take_mapped_entry(host_addr + (done + i) * PAGE_SIZE);
+            if(entry[i] == NULL)
+            {
+                if(status)
+                {
+                    status[done + i] = GNTST_bad_virt_addr;
+                }
+                retval = -1;
+                continue;
+            }
+
+            op[nr_ops].host_addr = (uint64_t) entry[i]->host_addr;
+            op[nr_ops].dev_bus_addr = 0;
+            op[nr_ops].handle = entry[i]->handle;
+            nr_ops++;
+        }
+
+        call_failed = nr_ops && HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, op, nr_ops);
+        if(call_failed)
+        {
+            printk("error executing GNTTABOP_unmap_grant_ref hypercall\r\n");
+            for(i = 0; i < nr_ops; i++)
+            {
+                op[i].status = GNTST_general_error;
+            }
+        }
+
+        nr_ops = 0;
+        for(i = 0; i < nr; i++)
+        {
+            if(entry[i] == NULL)
+            {
+                continue;
+            }
+
+            if(status)
+            {
+                status[done + i] = op[nr_ops].status;
+            }
+
+            if(op[nr_ops].status == GNTST_okay)
+            {
+                release_entry(entry[i]);
+            }
+            else
+            {
+                if(!call_failed)
+                {
+                    printk("error unmapping grant handle %u: status %d\r\n",
+                        (unsigned int) op[nr_ops].handle, op[nr_ops].status);
+                }
+                /* Still mapped, it can be unmapped again */
+                local_irq_disable();
+                entry[i]->mapped = 1;
+                local_irq_enable();
+                retval = -1;
+            }
+            nr_ops++;
+        }
     }
 
-    return 0;
+    return retval;
 }
@@ -19,15 +19,30 @@
 #define _XEN_GNTMAP_H_
 
 /******** Includes ************************************************************/
+#include <stddef.h>
+
 #include "xen/xen.h"
+#include "xen/grant_table.h"
 
 
 /******** Definitions *********************************************************/
+/* Pages that can be mapped at once, each keeps the handle to unmap it. A
+ * page beyond this limit fails to map with GNTST_bad_virt_addr until another
+ * one is unmapped. */
+#ifndef GNTMAP_MAX_ENTRIES
+#define GNTMAP_MAX_ENTRIES  64
+#endif
 
 
 /******** Public Functions ****************************************************/
 int gntmap_map_grant_ref(unsigned long host_addr, uint32_t domid, uint32_t ref,
     int writeable);
+int gntmap_unmap_grant_ref(unsigned long host_addr);
+
+int gntmap_map_grant_refs(unsigned long host_addr, uint32_t domid,
+    const grant_ref_t * refs, size_t count, int writeable, int16_t * status);
+int gntmap_unmap_grant_refs(unsigned long host_addr, size_t count,
+    int16_t * status);
 
 
 #endif /* _XEN_GNTMAP_H_ */
@@ -18,6 +18,7 @@
 /******** Includes ************************************************************/
 #include "xen_gnttab.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "arm64_ops.h"
@@ -31,20 +32,66 @@
 
 
 /******** Definitions *********************************************************/
-#define GRANT_TABLE_BASE    0x38000000
-#define GRANT_TABLE_FRAMES  4
-
-#define GRANT_ENTRIES       (GRANT_TABLE_FRAMES * PAGE_SIZE / sizeof(grant_entry_v1_t))
+/* Guest address range the grant table frames are mapped at, which has to be
+ * free in the guest's memory map for GRANT_TABLE_MAX_FRAMES pages, and with
+ * version 2 for the status frames after them */
+#ifndef GRANT_TABLE_BASE
+#define GRANT_TABLE_BASE        0x38000000
+#endif
+
+#ifndef GRANT_TABLE_MAX_FRAMES
+#define GRANT_TABLE_MAX_FRAMES  32
+#endif
+
+/* Frames set up by gnttab_init(), more are added as entries run low */
+#ifndef GRANT_TABLE_INIT_FRAMES
+#define GRANT_TABLE_INIT_FRAMES 4
+#endif
+
+/* Free entries below which another frame is added */
+#ifndef GRANT_TABLE_LOW_WATER
+#define GRANT_TABLE_LOW_WATER   64
+#endif
+
+/* Set to 2 to use grant table version 2 where Xen offers it. Its status
+ * frames keep Xen's in-use flags apart from the entries, so ending access
+ * does not contend with the backend on the entry, and it allows sub-page
+ * grants. Falls back to version 1 otherwise. */
+#ifndef GRANT_TABLE_VERSION
+#define GRANT_TABLE_VERSION     1
+#endif
+
+#define GRANT_STATUS_BASE   (GRANT_TABLE_BASE + GRANT_TABLE_MAX_FRAMES * PAGE_SIZE)
+#define STATUS_PER_FRAME    (PAGE_SIZE / sizeof(grant_status_t))
+#define MAX_STATUS_FRAMES   ((GRANT_TABLE_MAX_FRAMES * (PAGE_SIZE / sizeof(grant_entry_v2_t)) + \
+                              STATUS_PER_FRAME - 1) / STATUS_PER_FRAME)
+
+/* The free list is kept in one chunk per frame */
+#define FREE_LINK(gref)     (gnttab_list[(gref) / gnttab_per_frame][(gref) % gnttab_per_frame])
 
 
 /******** Function Prototypes *************************************************/
 static void put_free_entry(grant_ref_t gref);
 static grant_ref_t get_free_entry(void);
+static int gnttab_grow(unsigned int nr_frames);
+static int map_status_frames(uint32_t nr_frames);
+static grant_ref_t alloc_entry(void);
+static void set_version(void);
 
 
 /******** Module Variables ****************************************************/
-static grant_entry_v1_t * gnttab_table;
-static grant_ref_t        gnttab_list[GRANT_ENTRIES];
+static grant_entry_v1_t * gnttab_table = (grant_entry_v1_t *)GRANT_TABLE_BASE;
+static grant_entry_v2_t * gnttab_table_v2 = (grant_entry_v2_t *)GRANT_TABLE_BASE;
+static grant_status_t *   gnttab_status = (grant_status_t *)GRANT_STATUS_BASE;
+static int                gnttab_version = 1;
+static uint32_t           gnttab_per_frame = PAGE_SIZE / sizeof(grant_entry_v1_t);
+static uint32_t           gnttab_nr_status_frames = 0;
+static grant_ref_t *      gnttab_list[GRANT_TABLE_MAX_FRAMES];
+static grant_ref_t        gnttab_free_head = INVALID_GREF;
+static volatile uint32_t  gnttab_free_count = 0;
+static volatile uint32_t  gnttab_nr_frames = 0;
+static uint32_t           gnttab_max_frames = 0;
+static volatile uint32_t  gnttab_growing = 0;
 
 
 /******** Private Functions ***************************************************/
@@ -52,8 +99,9 @@ static void put_free_entry(grant_ref_t gref)
 {
     local_irq_disable();
 
-    gnttab_list[gref] = gnttab_list[0];
-    gnttab_list[0] = gref;
+    FREE_LINK(gref) = gnttab_free_head;
+    gnttab_free_head = gref;
+    gnttab_free_count++;
 
     local_irq_enable();
     return;
@@ -65,58 +113,310 @@ static grant_ref_t get_free_entry(void)
 
     local_irq_disable();
 
-    gref = gnttab_list[0];
-    if(gref < GNTTAB_NR_RESERVED_ENTRIES || gref >= GRANT_ENTRIES)
+    gref = gnttab_free_head;
+    if(gref == INVALID_GREF)
     {
         local_irq_enable();
         return INVALID_GREF;
     }
 
-    gnttab_list[0] = gnttab_list[gref];
+    gnttab_free_head = FREE_LINK(gref);
+    gnttab_free_count--;
 
     local_irq_enable();
     return gref;
 }
 
+/* Adds frames to the end of the table and their entries to the free list.
+ * Only one caller grows the table at a time, the others return. */
+static int gnttab_grow(unsigned int nr_frames)
+{
+    struct xen_add_to_physmap xatp;
+    struct gnttab_setup_table setup;
+    xen_pfn_t                 frames[GRANT_TABLE_MAX_FRAMES];
+    uintptr_t                 addr;
+    uint32_t                  frame;
+    grant_ref_t               gref;
+    int                       retval = -1;
+
+    if(__atomic_exchange_n(&gnttab_growing, 1, __ATOMIC_ACQUIRE))
+    {
+        return -1;
+    }
+    frame = gnttab_nr_frames;
+
+    while(nr_frames > 0 && gnttab_nr_frames < gnttab_max_frames)
+    {
+        frame = gnttab_nr_frames;
+
+        gnttab_list[frame] = malloc(gnttab_per_frame * sizeof(grant_ref_t));
+        if(gnttab_list[frame] == NULL)
+        {
+            goto exit;
+        }
+
+        /* Map the grant table page */
+        addr = GRANT_TABLE_BASE + frame * PAGE_SIZE;
+        if(bmc_mem_mapper((void*)addr, (void*)addr, PAGE_SIZE, 2))
+        {
+            printk("grant table mem map failed\r\n");
+            goto exit;
+        }
+
+        /* Setup the grant table map with the Xen kernel, Xen grows its table
+         * to cover the frame */
+        xatp.domid = DOMID_SELF;
+        xatp.size  = 0; /* Seems to be unused */
+        xatp.space = XENMAPSPACE_grant_table;
+        xatp.idx   = frame;
+        xatp.gpfn  = addr >> PAGE_SHIFT;
+
+        if(HYPERVISOR_memory_op(XENMEM_add_to_physmap, &xatp))
+        {
+            printk("error executing XENMEM_add_to_physmap hypercall\r\n");
+            goto exit;
+        }
+
+        setup.dom = DOMID_SELF;
+        setup.nr_frames = frame + 1;
+        set_xen_guest_handle(setup.frame_list, frames);
+        HYPERVISOR_grant_table_op(GNTTABOP_setup_table, &setup, 1);
+        if(setup.status)
+        {
+            printk("error executing GNTTABOP_setup_table hypercall\r\n");
+            goto exit;
+        }
+
+        /* Version 2 keeps the status of the new entries in further frames */
+        if(gnttab_version == 2 && map_status_frames(
+            ((frame + 1) * gnttab_per_frame + STATUS_PER_FRAME - 1) / STATUS_PER_FRAME) != 0)
+        {
+            goto exit;
+        }
+
+        /* Xen hands out new frames zeroed, and frame 0 already holds the
+         * toolstack's reserved entries, so the page is left as it is */
+        gnttab_nr_frames = frame + 1;
+
+        for(gref = frame * gnttab_per_frame; gref < (frame + 1) * gnttab_per_frame; gref++)
+        {
+            if(gref >= GNTTAB_NR_RESERVED_ENTRIES)
+            {
+                put_free_entry(gref);
+            }
+        }
+
+        nr_frames--;
+    }
+
+    retval = (nr_frames == 0) ? 0 : -1;
+
+exit:
+    /* Drop the free list chunk of a frame that could not be added */
+    if(frame < GRANT_TABLE_MAX_FRAMES && frame >= gnttab_nr_frames)
+    {
+        free(gnttab_list[frame]);
+        gnttab_list[frame] = NULL;
+    }
+
+    __atomic_store_n(&gnttab_growing, 0, __ATOMIC_RELEASE);
+
+    return retval;
+}
+
+/* Maps the version 2 status frames up to nr_frames */
+static int map_status_frames(uint32_t nr_frames)
+{
+    struct gnttab_get_status_frames status;
+    struct xen_add_to_physmap       xatp;
+    uint64_t                        frames[MAX_STATUS_FRAMES];
+    uintptr_t                       addr;
+
+    if(nr_frames <= gnttab_nr_status_frames)
+    {
+        return 0;
+    }
+
+    /* Makes sure Xen has grown the status part of the table as well */
+    status.nr_frames = nr_frames;
+    status.dom = DOMID_SELF;
+    set_xen_guest_handle(status.frame_list, frames);
+    HYPERVISOR_grant_table_op(GNTTABOP_get_status_frames, &status, 1);
+    if(status.status != GNTST_okay)
+    {
+        printk("error executing GNTTABOP_get_status_frames hypercall\r\n");
+        return -1;
+    }
+
+    while(gnttab_nr_status_frames < nr_frames)
+    {
+        addr = GRANT_STATUS_BASE + gnttab_nr_status_frames * PAGE_SIZE;
+        if(bmc_mem_mapper((void*)addr, (void*)addr, PAGE_SIZE, 2))
+        {
+            printk("grant table mem map failed\r\n");
+            return -1;
+        }
+
+        xatp.domid = DOMID_SELF;
+        xatp.size  = 0; /* Seems to be unused */
+        xatp.space = XENMAPSPACE_grant_table;
+        xatp.idx   = gnttab_nr_status_frames | XENMAPIDX_grant_table_status;
+        xatp.gpfn  = addr >> PAGE_SHIFT;
+
+        if(HYPERVISOR_memory_op(XENMEM_add_to_physmap, &xatp))
+        {
+            printk("error executing XENMEM_add_to_physmap hypercall\r\n");
+            return -1;
+        }
+
+        gnttab_nr_status_frames++;
+    }
+
+    return 0;
+}
+
+/* Takes a free entry, adding a frame to the table if they run out or low */
+static grant_ref_t alloc_entry(void)
+{
+    grant_ref_t gref;
+
+    gref = get_free_entry();
+    if(gref == INVALID_GREF && !xen_in_isr() &&
+       gnttab_grow(1) == 0)
+    {
+        gref = get_free_entry();
+    }
+
+    if(gref == INVALID_GREF)
+    {
+        return INVALID_GREF;
+    }
+
+    /* Add a frame ahead of running out */
+    if(gnttab_free_count < GRANT_TABLE_LOW_WATER && !xen_in_isr())
+    {
+        gnttab_grow(1);
+    }
+
+    return gref;
+}
+
+/* Switches to GRANT_TABLE_VERSION, which has to happen before any grant */
+static void set_version(void)
+{
+    struct gnttab_set_version version;
+
+    if(GRANT_TABLE_VERSION != 2)
+    {
+        return;
+    }
+
+    version.version = 2;
+    if(HYPERVISOR_grant_table_op(GNTTABOP_set_version, &version, 1) != 0 ||
+       version.version != 2)
+    {
+        printk("grant table version 2 not available, using version 1\r\n");
+        return;
+    }
+
+    gnttab_version = 2;
+    gnttab_per_frame = PAGE_SIZE / sizeof(grant_entry_v2_t);
+}
+
 
 /******** Public Functions ****************************************************/
 grant_ref_t gnttab_grant_access(domid_t domid, unsigned long pfn, int readonly)
 {
     grant_ref_t gref;
+    uint16_t    flags;
 
-    gref = get_free_entry();
+    gref = alloc_entry();
     if(gref == INVALID_GREF)
     {
         return INVALID_GREF;
     }
 
-    gnttab_table[gref].frame = pfn;
-    gnttab_table[gref].domid = domid;
-    wmb();
+    flags = readonly ? (GTF_permit_access | GTF_readonly) : GTF_permit_access;
 
-    if(readonly)
+    if(gnttab_version == 2)
     {
-        gnttab_table[gref].flags = GTF_permit_access | GTF_readonly;
+        gnttab_table_v2[gref].full_page.frame = pfn;
+        gnttab_table_v2[gref].hdr.domid = domid;
+        wmb();
+        gnttab_table_v2[gref].hdr.flags = flags;
     }
     else
     {
-        gnttab_table[gref].flags = GTF_permit_access;
+        gnttab_table[gref].frame = pfn;
+        gnttab_table[gref].domid = domid;
+        wmb();
+        gnttab_table[gref].flags = flags;
     }
 
     return gref;
 }
 
+/*
+ * Grants domid access to length bytes at offset in the page, which it can
+ * copy from or to but not map. Needs grant table version 2.
+ */
+grant_ref_t gnttab_grant_access_subpage(domid_t domid, unsigned long pfn,
+    unsigned int offset, unsigned int length, int readonly)
+{
+    grant_ref_t gref;
+    uint16_t    flags;
+
+    if(gnttab_version != 2 || offset >= PAGE_SIZE || length > PAGE_SIZE - offset)
+    {
+        return INVALID_GREF;
+    }
+
+    gref = alloc_entry();
+    if(gref == INVALID_GREF)
+    {
+        return INVALID_GREF;
+    }
+
+    flags = GTF_permit_access | GTF_sub_page | (readonly ? GTF_readonly : 0);
+
+    gnttab_table_v2[gref].sub_page.frame = pfn;
+    gnttab_table_v2[gref].sub_page.page_off = offset;
+    gnttab_table_v2[gref].sub_page.length = length;
+    gnttab_table_v2[gref].hdr.domid = domid;
+    wmb();
+    gnttab_table_v2[gref].hdr.flags = flags;
+
+    return gref;
+}
+
 int gnttab_end_access(grant_ref_t gref)
 {
     grant_entry_v1_t * entry;
     uint16_t flags;
     uint16_t nflags;
 
-    if(gref < GNTTAB_NR_RESERVED_ENTRIES || gref >= GRANT_ENTRIES)
+    if(gref < GNTTAB_NR_RESERVED_ENTRIES ||
+       gref >= gnttab_nr_frames * gnttab_per_frame)
     {
         return -1;
     }
 
+    if(gnttab_version == 2)
+    {
+        /* Revoke the grant, then check Xen's status for it in its own frame.
+         * A grant still in use stays revoked and can be ended again later. */
+        gnttab_table_v2[gref].hdr.flags = 0;
+        mb();
+        if(gnttab_status[gref] & (GTF_reading | GTF_writing))
+        {
+            return -1;
+        }
+        rmb();
+
+        put_free_entry(gref);
+        return 0;
+    }
+
     entry = &gnttab_table[gref];
 
     nflags = entry->flags;
@@ -135,56 +435,49 @@ int gnttab_end_access(grant_ref_t gref)
     return 0;
 }
 
+/* Returns the number of grant entries currently free */
+unsigned int gnttab_free_entries(void)
+{
+    return gnttab_free_count;
+}
+
 void gnttab_init(void)
 {
-    int    i;
-    struct xen_add_to_physmap xatp;
-    struct gnttab_setup_table setup;
-    xen_pfn_t frames[GRANT_TABLE_FRAMES];
+    struct gnttab_query_size query;
+    uint32_t                 frames;
 
-    /* Initialize grant table free list */
-    memset(gnttab_list, 0, sizeof(gnttab_list));
-    for(i = GNTTAB_NR_RESERVED_ENTRIES; i < GRANT_ENTRIES; i++)
+    /* Find out how far Xen lets the table grow */
+    query.dom = DOMID_SELF;
+    HYPERVISOR_grant_table_op(GNTTABOP_query_size, &query, 1);
+    if(query.status != GNTST_okay)
     {
-        put_free_entry(i);
+        printk("error executing GNTTABOP_query_size hypercall\r\n");
+        return;
     }
 
-    /* Map the grant table pages */
-    if(bmc_mem_mapper((void*)GRANT_TABLE_BASE, (void*)GRANT_TABLE_BASE,
-        PAGE_SIZE * GRANT_TABLE_FRAMES, 2))
+    set_version();
+
+    gnttab_max_frames = query.max_nr_frames;
+    if(gnttab_max_frames > GRANT_TABLE_MAX_FRAMES)
     {
-        printk("grant table mem map failed\r\n");
-        return;
+        gnttab_max_frames = GRANT_TABLE_MAX_FRAMES;
     }
 
-    /* Setup the grant table map with the Xen kernel */
-    for(i = 0; i < GRANT_TABLE_FRAMES; i++)
+    /* Start with at least as many frames as Xen already has */
+    frames = GRANT_TABLE_INIT_FRAMES;
+    if(frames < query.nr_frames)
     {
-        xatp.domid = DOMID_SELF;
-        xatp.size  = 0; /* Seems to be unused */
-        xatp.space = XENMAPSPACE_grant_table;
-        xatp.idx   = i;
-        xatp.gpfn  = (GRANT_TABLE_BASE >> PAGE_SHIFT) + i;
-
-        if(HYPERVISOR_memory_op(XENMEM_add_to_physmap, &xatp))
-        {
-            printk("error executing XENMEM_add_to_physmap hypercall\r\n");
-            return;
-        }
+        frames = query.nr_frames;
     }
-
-    setup.dom = DOMID_SELF;
-    setup.nr_frames = GRANT_TABLE_FRAMES;
-    set_xen_guest_handle(setup.frame_list, frames);
-    HYPERVISOR_grant_table_op(GNTTABOP_setup_table, &setup, 1);
-    if(setup.status)
+    if(frames > gnttab_max_frames)
     {
-        printk("error executing GNTTABOP_setup_table hypercall\r\n");
-        return;
+        frames = gnttab_max_frames;
     }
 
-    /* BMC set up a direct VA:PA mapping */
-    gnttab_table = (grant_entry_v1_t *)GRANT_TABLE_BASE;
+    if(gnttab_grow(frames) != 0)
+    {
+        printk("grant table set up failed\r\n");
+    }
 
     return;
 }
@@ -30,7 +30,10 @@
 
 /******** Public Functions ****************************************************/
 grant_ref_t gnttab_grant_access(domid_t domid, unsigned long pfn, int readonly);
+grant_ref_t gnttab_grant_access_subpage(domid_t domid, unsigned long pfn,
+    unsigned int offset, unsigned int length, int readonly);
 int gnttab_end_access(grant_ref_t gref);
+unsigned int gnttab_free_entries(void);
 
 void gnttab_init(void);
 
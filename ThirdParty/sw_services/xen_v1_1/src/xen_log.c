@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Lock-free multi-producer log ring. Producers reserve a record by moving the
+ * head with a compare-and-swap, fill it in place and mark it committed, so
+ * tasks and ISRs can log concurrently without a lock and without blocking. A
+ * single consumer task drains committed records in order and wakes on a task
+ * notification. When the ring is full the message is dropped and counted.
+ */
+
+/******** Includes ************************************************************/
+#include "xen_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "arm64_ops.h"
+
+
+/******** Definitions *********************************************************/
+#if (XEN_LOG_BUF_SIZE & (XEN_LOG_BUF_SIZE - 1)) || (XEN_LOG_BUF_SIZE > 32768)
+#error "XEN_LOG_BUF_SIZE must be a power of two of at most 32768"
+#endif
+
+#define LOG_BUF_MASK            (XEN_LOG_BUF_SIZE - 1)
+#define LOG_REC_ALIGN           sizeof(xen_log_rec_t)
+#define LOG_REC_SIZE(len)       ((sizeof(xen_log_rec_t) + (len) + LOG_REC_ALIGN - 1) & ~(LOG_REC_ALIGN - 1))
+
+
+/******** Function Prototypes *************************************************/
+static void log_wake_consumer(void);
+
+
+/******** Module Variables ****************************************************/
+static __attribute__((aligned(8))) u8 log_buf[XEN_LOG_BUF_SIZE];
+
+/* Free running byte positions; head is shared by the producers, tail is only
+ * written by the consumer */
+static volatile u32 log_head = 0;
+static volatile u32 log_tail = 0;
+
+static volatile u32 log_dropped = 0;
+static volatile u32 log_wake_pending = 0;
+static TaskHandle_t log_consumer = NULL;
+
+
+/******** Private Functions ***************************************************/
+// Gives the consumer a notification unless one is already outstanding
+static void log_wake_consumer(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    if(log_consumer == NULL)
+    {
+        return;
+    }
+
+    if(__atomic_exchange_n(&log_wake_pending, 1, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
+
+    if(xen_in_isr())
+    {
+        vTaskNotifyGiveFromISR(log_consumer, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+    else
+    {
+        xTaskNotifyGive(log_consumer);
+    }
+}
+
+
+/******** Public Functions ****************************************************/
+// Reserves room for a record with up to len bytes of payload. Returns NULL,
+// and counts the drop, if the ring does not have the space.
+xen_log_rec_t * xen_log_reserve(unsigned int len)
+{
+    xen_log_rec_t * rec;
+    xen_log_rec_t * skip;
+    u32 size = LOG_REC_SIZE(len);
+    u32 head, tail, offset, pad;
+
+    if(size > XEN_LOG_BUF_SIZE / 2)
+    {
+        __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    head = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    do
+    {
+        tail = __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+        offset = head & LOG_BUF_MASK;
+
+        /* Records never wrap, the end of the buffer is padded out instead */
+        pad = (offset + size > XEN_LOG_BUF_SIZE) ? XEN_LOG_BUF_SIZE - offset : 0;
+
+        if((head + pad + size) - tail > XEN_LOG_BUF_SIZE)
+        {
+            __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    } while(!__atomic_compare_exchange_n(&log_head, &head, head + pad + size,
+        0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if(pad != 0)
+    {
+        skip = (xen_log_rec_t *)&log_buf[offset];
+        skip->size = pad;
+        skip->len = 0;
+        skip->flags = 0;
+        __atomic_store_n(&skip->state, LOG_REC_SKIP, __ATOMIC_RELEASE);
+    }
+
+    rec = (xen_log_rec_t *)&log_buf[(head + pad) & LOG_BUF_MASK];
+    rec->size = size;
+    rec->len = len;
+    rec->flags = 0;
+
+    return rec;
+}
+
+void * xen_log_data(xen_log_rec_t * rec)
+{
+    return rec + 1;
+}
+
+// Publishes a reserved record with len bytes of payload, no more than were
+// reserved. If nothing was reserved after it, the unused space is returned.
+void xen_log_commit(xen_log_rec_t * rec, unsigned int len)
+{
+    u32 size = LOG_REC_SIZE(len);
+    u32 end = (((u8 *)rec - log_buf) + rec->size) & LOG_BUF_MASK;
+    u32 head;
+
+    if(size < rec->size)
+    {
+        /* The record is uncommitted so the head is within one lap of it, and
+         * matching offsets mean it is still the last reservation */
+        head = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        if((head & LOG_BUF_MASK) == end &&
+           __atomic_compare_exchange_n(&log_head, &head, head - (rec->size - size),
+               0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            rec->size = size;
+        }
+    }
+
+    rec->len = len;
+    __atomic_store_n(&rec->state, LOG_REC_COMMITTED, __ATOMIC_RELEASE);
+
+    log_wake_consumer();
+}
+
+// Formats a message straight into the ring. Returns the number of characters
+// logged, or -1 if the message was dropped.
+int xen_log_vprintf(const char * fmt, va_list args)
+{
+    xen_log_rec_t * rec;
+    int len;
+
+    rec = xen_log_reserve(XEN_LOG_LINE_MAX);
+    if(rec == NULL)
+    {
+        return -1;
+    }
+
+    len = vsnprintf(xen_log_data(rec), XEN_LOG_LINE_MAX, fmt, args);
+    if(len < 0)
+    {
+        len = 0;
+    }
+    else if(len > XEN_LOG_LINE_MAX - 1)
+    {
+        len = XEN_LOG_LINE_MAX - 1;
+    }
+
+    xen_log_commit(rec, len);
+
+    return len;
+}
+
+// Sets the task that drains the ring. Records committed before it runs are
+// kept until the first drain.
+void xen_log_set_consumer(TaskHandle_t task)
+{
+    log_consumer = task;
+    wmb();
+    if(log_consumer != NULL && log_head != log_tail)
+    {
+        log_wake_consumer();
+    }
+}
+
+int xen_log_has_consumer(void)
+{
+    return log_consumer != NULL;
+}
+
+// Hands every committed record to the sink, oldest first, stopping at the
+// first one still being written. Only the consumer task may call this.
+// Returns the number of records passed to the sink.
+unsigned int xen_log_drain(xen_log_sink_t sink)
+{
+    xen_log_rec_t * rec;
+    unsigned int count = 0;
+    u32 tail = log_tail;
+    u32 size;
+    u16 state;
+
+    __atomic_store_n(&log_wake_pending, 0, __ATOMIC_RELEASE);
+
+    while(tail != __atomic_load_n(&log_head, __ATOMIC_ACQUIRE))
+    {
+        rec = (xen_log_rec_t *)&log_buf[tail & LOG_BUF_MASK];
+        state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+        if(state == LOG_REC_EMPTY)
+        {
+            break;
+        }
+
+        if(state == LOG_REC_COMMITTED)
+        {
+            sink(rec, xen_log_data(rec));
+            count++;
+        }
+
+        /* Zero the whole record so stale payload is never taken for a header */
+        size = rec->size;
+        memset(rec, 0, size);
+        tail += size;
+        __atomic_store_n(&log_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return count;
+}
+
+u32 xen_log_dropped(void)
+{
+    return log_dropped;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _XEN_LOG_H_
+#define _XEN_LOG_H_
+
+/******** Includes ************************************************************/
+#include <stdarg.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "types.h"
+
+
+/******** Definitions *********************************************************/
+/* Size of the log ring. Must be a power of two, and at most 32 KiB so record
+ * sizes fit the 16-bit header fields. */
+#ifndef XEN_LOG_BUF_SIZE
+#define XEN_LOG_BUF_SIZE        16384
+#endif
+
+/* Longest formatted message, including the terminating NUL vsnprintf writes */
+#ifndef XEN_LOG_LINE_MAX
+#define XEN_LOG_LINE_MAX        1024
+#endif
+
+/* Record states. A reserved record stays LOG_REC_EMPTY until it is committed,
+ * which is where the consumer stops. */
+#define LOG_REC_EMPTY           0
+#define LOG_REC_COMMITTED       1
+#define LOG_REC_SKIP            2   // padding up to the end of the buffer
+
+/* Record flags */
+#define LOG_REC_F_RAW           0x0001  // binary payload, copied without newline translation
+
+typedef struct xen_log_rec
+{
+    volatile u16 state;
+    u16          size;              // bytes in the ring, header included
+    u16          len;               // bytes of payload
+    u16          flags;
+} xen_log_rec_t;
+
+/* Called by xen_log_drain() for every committed record, oldest first */
+typedef void (*xen_log_sink_t)(const xen_log_rec_t * rec, const void * data);
+
+
+/******** Public Functions ****************************************************/
+xen_log_rec_t * xen_log_reserve(unsigned int len);
+void *          xen_log_data(xen_log_rec_t * rec);
+void            xen_log_commit(xen_log_rec_t * rec, unsigned int len);
+
+int  xen_log_vprintf(const char * fmt, va_list args);
+
+void xen_log_set_consumer(TaskHandle_t task);
+int  xen_log_has_consumer(void);
+unsigned int xen_log_drain(xen_log_sink_t sink);
+u32  xen_log_dropped(void);
+
+
+#endif /* _XEN_LOG_H_ */
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Bulk copies for the byte rings shared with backends. Data moves with at
+ * most two memcpy() calls per operation, one up to the end of the ring and
+ * one from its start, and the barriers around the shared indexes live here
+ * instead of in each driver.
+ */
+
+/******** Includes ************************************************************/
+#include "xen_ring.h"
+
+#include <string.h>
+
+#include "arm64_ops.h"
+
+
+/******** Definitions *********************************************************/
+#define RING_OFFSET(idx, size)  ((idx) & ((size) - 1))
+
+
+/******** Function Prototypes *************************************************/
+
+
+/******** Module Variables ****************************************************/
+
+
+/******** Private Functions ***************************************************/
+
+
+/******** Public Functions ****************************************************/
+
+/* Copies len bytes into a ring at index prod */
+void xen_ring_copy_in(char * ring, xen_ring_idx_t size, xen_ring_idx_t prod,
+    const void * src, size_t len)
+{
+    xen_ring_idx_t offset = RING_OFFSET(prod, size);
+    size_t         first = size - offset;
+
+    if(first > len)
+    {
+        first = len;
+    }
+
+    memcpy(ring + offset, src, first);
+    memcpy(ring, (const char *)src + first, len - first);
+}
+
+/* Copies len bytes out of a ring at index cons */
+void xen_ring_copy_out(void * dst, const char * ring, xen_ring_idx_t size,
+    xen_ring_idx_t cons, size_t len)
+{
+    xen_ring_idx_t offset = RING_OFFSET(cons, size);
+    size_t         first = size - offset;
+
+    if(first > len)
+    {
+        first = len;
+    }
+
+    memcpy(dst, ring + offset, first);
+    memcpy((char *)dst + first, ring, len - first);
+}
+
+/* Copies len bytes from one ring to another, in at most three pieces */
+void xen_ring_copy_ring(char * dst, xen_ring_idx_t dst_size,
+    xen_ring_idx_t dst_prod, const char * src, xen_ring_idx_t src_size,
+    xen_ring_idx_t src_cons, size_t len)
+{
+    size_t run;
+
+    while(len > 0)
+    {
+        run = len;
+        if(run > src_size - RING_OFFSET(src_cons, src_size))
+        {
+            run = src_size - RING_OFFSET(src_cons, src_size);
+        }
+        if(run > dst_size - RING_OFFSET(dst_prod, dst_size))
+        {
+            run = dst_size - RING_OFFSET(dst_prod, dst_size);
+        }
+
+        memcpy(dst + RING_OFFSET(dst_prod, dst_size),
+            src + RING_OFFSET(src_cons, src_size), run);
+        dst_prod += run;
+        src_cons += run;
+        len -= run;
+    }
+}
+
+/* Consumer side: returns the number of bytes that can be read and the
+ * consumer index in *cons. The data is safe to read after this. */
+xen_ring_idx_t xen_ring_readable(const xen_byte_ring_t * ring,
+    xen_ring_idx_t * cons)
+{
+    xen_ring_idx_t prod;
+
+    *cons = *ring->cons;
+    prod = *ring->prod;
+    mb();
+
+    return prod - *cons;
+}
+
+/* Producer side: returns the number of bytes that can be written and the
+ * producer index in *prod */
+xen_ring_idx_t xen_ring_writable(const xen_byte_ring_t * ring,
+    xen_ring_idx_t * prod)
+{
+    xen_ring_idx_t cons;
+
+    cons = *ring->cons;
+    *prod = *ring->prod;
+    mb();
+
+    return ring->size - (*prod - cons);
+}
+
+/* Makes the data written up to prod visible to the backend. Returns whether
+ * the backend has to be notified. */
+int xen_ring_publish_prod(const xen_byte_ring_t * ring, xen_ring_idx_t old_prod,
+    xen_ring_idx_t prod)
+{
+    if(prod == old_prod)
+    {
+        return 0;
+    }
+
+    wmb();
+    *ring->prod = prod;
+
+    mb();
+    return xen_ring_push_check_notify(old_prod, *ring->cons);
+}
+
+/* Hands the space read up to cons back to the backend. Returns whether the
+ * backend has to be notified, see xen_ring_pop_check_notify(). */
+int xen_ring_publish_cons(const xen_byte_ring_t * ring, xen_ring_idx_t old_cons,
+    xen_ring_idx_t cons, xen_ring_idx_t needed)
+{
+    if(cons == old_cons)
+    {
+        return 0;
+    }
+
+    mb();
+    *ring->cons = cons;
+
+    mb();
+    return xen_ring_pop_check_notify(*ring->prod, old_cons, ring->size, needed);
+}
+
+/* Writes as much of data as fits and publishes it. Returns the number of
+ * bytes written, and in *notify whether the backend has to hear about them. */
+size_t xen_ring_write(const xen_byte_ring_t * ring, const void * data,
+    size_t len, int * notify)
+{
+    xen_ring_idx_t prod;
+    xen_ring_idx_t space;
+
+    space = xen_ring_writable(ring, &prod);
+    if(len > space)
+    {
+        len = space;
+    }
+
+    xen_ring_copy_in(ring->buf, ring->size, prod, data, len);
+    *notify = xen_ring_publish_prod(ring, prod, prod + len);
+
+    return len;
+}
+
+/* Reads up to len bytes into data, or skips them if data is NULL, and frees
+ * their space. Returns the number of bytes read, and in *notify whether the
+ * backend has to hear about the space. */
+size_t xen_ring_read(const xen_byte_ring_t * ring, void * data, size_t len,
+    xen_ring_idx_t needed, int * notify)
+{
+    xen_ring_idx_t cons;
+    xen_ring_idx_t avail;
+
+    avail = xen_ring_readable(ring, &cons);
+    if(len > avail)
+    {
+        len = avail;
+    }
+
+    if(data != NULL)
+    {
+        xen_ring_copy_out(data, ring->buf, ring->size, cons, len);
+    }
+    *notify = xen_ring_publish_cons(ring, cons, cons + len, needed);
+
+    return len;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _XEN_RING_H_
+#define _XEN_RING_H_
+
+/******** Includes ************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+
+
+/******** Definitions *********************************************************/
+typedef uint32_t xen_ring_idx_t;
+
+/*
+ * One direction of a byte ring shared with a backend: the data area, whose
+ * size is a power of two, and the free running producer and consumer indexes
+ * in the shared page. Which of the two this side owns depends on whether it
+ * writes or reads the ring.
+ */
+typedef struct xen_byte_ring
+{
+    char *                    buf;
+    xen_ring_idx_t            size;
+    volatile xen_ring_idx_t * prod;
+    volatile xen_ring_idx_t * cons;
+} xen_byte_ring_t;
+
+
+/******** Public Functions ****************************************************/
+
+/*
+ * Notification suppression for the byte rings shared with backends, after
+ * RING_PUSH_REQUESTS_AND_CHECK_NOTIFY. A producer only has to raise an event
+ * if the consumer may already have caught up with everything published before
+ * the new data, since a consumer that is still behind has not gone idle yet.
+ *
+ * Call after publishing the new producer index followed by mb(). old_prod is
+ * the producer index before publishing, cons the consumer index read after
+ * the barrier.
+ */
+static inline int xen_ring_push_check_notify(xen_ring_idx_t old_prod,
+    xen_ring_idx_t cons)
+{
+    return (int32_t)(cons - old_prod) >= 0;
+}
+
+/*
+ * A consumer only has to raise an event if the producer may have been stalled
+ * waiting for space, i.e. if less than 'needed' bytes were free before the
+ * consumer published its new index. 'needed' is the largest amount of space
+ * the producer waits for at once: 1 for producers that write partial chunks.
+ *
+ * Call after publishing the new consumer index followed by mb(). old_cons is
+ * the consumer index before publishing, prod the producer index read after
+ * the barrier.
+ */
+static inline int xen_ring_pop_check_notify(xen_ring_idx_t prod,
+    xen_ring_idx_t old_cons, xen_ring_idx_t size, xen_ring_idx_t needed)
+{
+    return (xen_ring_idx_t)(prod - old_cons) > (size - needed);
+}
+
+void xen_ring_copy_in(char * ring, xen_ring_idx_t size, xen_ring_idx_t prod,
+    const void * src, size_t len);
+void xen_ring_copy_out(void * dst, const char * ring, xen_ring_idx_t size,
+    xen_ring_idx_t cons, size_t len);
+void xen_ring_copy_ring(char * dst, xen_ring_idx_t dst_size,
+    xen_ring_idx_t dst_prod, const char * src, xen_ring_idx_t src_size,
+    xen_ring_idx_t src_cons, size_t len);
+
+xen_ring_idx_t xen_ring_readable(const xen_byte_ring_t * ring,
+    xen_ring_idx_t * cons);
+xen_ring_idx_t xen_ring_writable(const xen_byte_ring_t * ring,
+    xen_ring_idx_t * prod);
+int xen_ring_publish_prod(const xen_byte_ring_t * ring, xen_ring_idx_t old_prod,
+    xen_ring_idx_t prod);
+int xen_ring_publish_cons(const xen_byte_ring_t * ring, xen_ring_idx_t old_cons,
+    xen_ring_idx_t cons, xen_ring_idx_t needed);
+
+size_t xen_ring_write(const xen_byte_ring_t * ring, const void * data,
+    size_t len, int * notify);
+size_t xen_ring_read(const xen_byte_ring_t * ring, void * data, size_t len,
+    xen_ring_idx_t needed, int * notify);
+
+
+#endif /* _XEN_RING_H_ */
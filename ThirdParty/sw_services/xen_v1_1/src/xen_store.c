@@ -23,37 +23,174 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "event_groups.h"
+#include "queue.h"
+#include "semphr.h"
+
 #include "arm64_ops.h"
 #include "hypercall.h"
 #include "mm.h"
 #include "xen_console.h"
 #include "xen_events.h"
+#include "xen_ring.h"
 #include "xzd_bmc.h"
 
 #include "xen/xen.h"
 #include "xen/hvm/hvm_op.h"
 #include "xen/hvm/params.h"
-#include "xen/io/xs_wire.h"
 
 
 /******** Definitions *********************************************************/
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
-typedef struct writeReq
+#if XENSTORE_MAX_PENDING > 24
+#error "XENSTORE_MAX_PENDING is limited by the bits of an event group"
+#endif
+
+/* Stack for the task that reads xenstore responses, in words */
+#ifndef XENSTORE_TASK_STACK_DEPTH
+#define XENSTORE_TASK_STACK_DEPTH 512
+#endif
+
+/* Watch events waiting for the watch task */
+#ifndef XENSTORE_WATCH_QUEUE_LEN
+#define XENSTORE_WATCH_QUEUE_LEN 16
+#endif
+
+#define WATCH_TOKEN_LEN     16
+
+/* Sizes of the paths and values the read cache keeps, longer ones are not
+ * cached */
+#ifndef XENSTORE_CACHE_PATH_MAX
+#define XENSTORE_CACHE_PATH_MAX     96
+#endif
+
+#ifndef XENSTORE_CACHE_VALUE_MAX
+#define XENSTORE_CACHE_VALUE_MAX    64
+#endif
+
+/* Formatted values up to this size are built on the stack */
+#ifndef XENSTORE_PRINTF_STACK
+#define XENSTORE_PRINTF_STACK       64
+#endif
+
+/* Room for the short responses: "OK", error names and numbers */
+#define XS_STATUS_LEN       24
+
+/* dir, "/", node and the null char */
+#define PATH_SEGS_MAX       4
+
+/* The low byte of a request ID is its slot, the rest a sequence number */
+#define REQ_ID(seq, slot)   (((seq) << 8) | (slot))
+#define REQ_ID_SLOT(req_id) ((req_id) & 0xff)
+
+typedef xenstore_seg_t write_req_t;
+
+enum xs_req_state
+{
+    XS_REQ_FREE,
+    XS_REQ_PENDING,         /* sent, waiting for the response */
+    XS_REQ_DONE             /* response received, waiting to be collected */
+};
+
+struct xs_request
+{
+    volatile int        state;
+    uint32_t            req_id;
+    xenstore_callback_t cb;
+    void *              arg;
+    struct xsd_sockmsg  rsp;
+    char *              body;       /* NUL terminated response payload */
+    char *              buf;        /* caller's buffer for the payload, if any */
+    size_t              buf_len;
+    int                 err;
+};
+
+
+struct xs_watch
+{
+    volatile int        used;
+    volatile int        busy;   /* the watch task is running cb */
+    xenstore_watch_cb_t cb;
+    void *              arg;
+    char *              path;
+    char                token[WATCH_TOKEN_LEN];
+};
+
+enum xs_cache_state
+{
+    CACHE_FREE,
+    CACHE_BUSY,             /* having its watch changed */
+    CACHE_LIVE
+};
+
+/* A cached value, kept up to date by a watch on its path */
+struct xs_cache_entry
 {
-    const void * data;
-    size_t       len;
-} write_req_t;
+    int      state;
+    int      watch;
+    int      valid;
+    int      initial;       /* the event fired when the watch is set is due */
+    uint32_t gen;           /* bumped by every change to the path */
+    uint32_t last_use;
+    size_t   len;
+    char     path[XENSTORE_CACHE_PATH_MAX];
+    char     value[XENSTORE_CACHE_VALUE_MAX];
+};
+
+/* A watch event on its way to the watch task, path and token back to back */
+struct xs_watch_event
+{
+    char * body;
+    size_t len;
+};
 
 
 /******** Function Prototypes *************************************************/
-char* path_join(const char* dir, const char* name);
+static size_t path_segs(const char * dir, const char * node, write_req_t * segs);
+static int    path_print(char * buf, size_t buf_len, const char * dir,
+    const char * node);
 
 static void write_req_buf(const void * data, size_t len);
-static void read_rsp_buf(void * data, size_t len);
+static void read_rsp_buf(void * data, size_t len, int block);
+static int  xs_task_mode(void);
+static int  xs_can_lock(void);
+static int  xs_lock(SemaphoreHandle_t lock, TickType_t ticks);
+static void xs_unlock(SemaphoreHandle_t lock);
+static int  xs_submit(enum xsd_sockmsg_type type,
+    xenbus_transaction_t trans_id, const write_req_t * req, size_t nr_reqs,
+    xenstore_callback_t cb, void * arg, char * buf, size_t buf_len,
+    TickType_t slot_wait);
+static void xs_read_message(int block);
+static void xs_complete(struct xs_request * req);
+static int  xs_wait(int slot, TickType_t ticks);
+static void xs_release(struct xs_request * req);
+static void xs_discard(void * arg, int err, char * data, size_t len);
+static void xs_queue_watch_event(struct xsd_sockmsg * msg, int block);
 static int  send_request(enum xsd_sockmsg_type type,
     xenbus_transaction_t trans_id, write_req_t* req, size_t nr_reqs,
-    struct xsd_sockmsg * resp);
+    struct xsd_sockmsg * resp, char ** body, char * buf, size_t buf_len);
+static char * xs_read(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, size_t * len, int cached);
+static int  xs_gather(xenbus_transaction_t trans_id, const char * dir,
+    xenstore_gather_t * keys, size_t nr_keys);
+static int  xs_vprintf(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, const char * format,
+    va_list args);
+
+static void xenstore_handle_event(void * data);
+static void xenstore_task(void * arg);
+static void xenstore_watch_task(void * arg);
+
+static void  cache_watch_cb(void * arg, const char * path, const char * token);
+static struct xs_cache_entry * cache_claim(const char * path, uint32_t * gen);
+static char * cache_lookup(const char * path, char * buf, size_t buf_len,
+    size_t * len);
+static void  cache_fill(struct xs_cache_entry * entry, uint32_t gen,
+    const char * value, size_t len);
+static void  cache_invalidate(const char * path);
 
 static int get_hv_param(int paramid, uint64_t * value);
 
@@ -61,126 +198,180 @@ static int get_hv_param(int paramid, uint64_t * value);
 /******** Module Variables ****************************************************/
 static evtchn_port_t                      xenstore_evtch;
 static struct xenstore_domain_interface * xenstore_buf;
-static uint32_t                           xenstore_req_id = 0;
+static xen_byte_ring_t                    xs_req_ring;
+static xen_byte_ring_t                    xs_rsp_ring;
+static uint32_t                           xenstore_req_seq = 0;
+
+static struct xs_request                  xs_requests[XENSTORE_MAX_PENDING];
+static TaskHandle_t                       xs_task = NULL;
+static EventGroupHandle_t                 xs_done = NULL;
+static SemaphoreHandle_t                  xs_write_lock = NULL;
+static SemaphoreHandle_t                  xs_read_lock = NULL;
+static SemaphoreHandle_t                  xs_free_slots = NULL;
+
+static struct xs_watch                    xs_watches[XENSTORE_MAX_WATCHES];
+static uint32_t                           xs_watch_seq = 0;
+static QueueHandle_t                      xs_watch_queue = NULL;
+static TaskHandle_t                       xs_watch_task = NULL;
+
+static int                                xs_cache_enabled = 0;
+static SemaphoreHandle_t                  xs_cache_lock = NULL;
+static struct xs_cache_entry              xs_cache[XENSTORE_CACHE_ENTRIES];
+static uint32_t                           xs_cache_clock = 0;
+static xenstore_cache_stats_t             xs_cache_stats;
 
 
 /******** Private Functions ***************************************************/
-char* path_join(const char* dir, const char* name)
+/* Describes dir/node as request segments, so the path is never built in
+ * memory. Returns the number of segments, the last one the null char. */
+static size_t path_segs(const char * dir, const char * node, write_req_t * segs)
 {
-    char* buffer;
+    size_t nr_segs = 0;
 
-    buffer = malloc(strlen(dir) + strlen(name) + 2); /* +2 for '/' and null character */
-    if(buffer == NULL)
+    segs[nr_segs].data  = dir;
+    segs[nr_segs++].len = strlen(dir);
+
+    if(node[0] != '\0')
     {
-        return NULL;
+        segs[nr_segs].data  = "/";
+        segs[nr_segs++].len = 1;
+        segs[nr_segs].data  = node;
+        segs[nr_segs++].len = strlen(node);
     }
 
-    if(strlen(name) > 0)
+    segs[nr_segs].data  = "";
+    segs[nr_segs++].len = 1; /* null char */
+
+    return nr_segs;
+}
+
+/* Builds dir/node in buf, returns -1 if it does not fit */
+static int path_print(char * buf, size_t buf_len, const char * dir,
+    const char * node)
+{
+    int size;
+
+    if(node[0] != '\0')
     {
-        snprintf(buffer, XENSTORE_ABS_PATH_MAX, "%s/%s", dir, name);
+        size = snprintf(buf, buf_len, "%s/%s", dir, node);
     }
     else
     {
-        snprintf(buffer, XENSTORE_ABS_PATH_MAX, "%s", dir);
+        size = snprintf(buf, buf_len, "%s", dir);
     }
 
-    return buffer;
+    return (size >= 0 && (size_t)size < buf_len) ? 0 : -1;
 }
 
 static void write_req_buf(const void * data, size_t len)
 {
-    XENSTORE_RING_IDX cons;
-    XENSTORE_RING_IDX prod;
     size_t written = 0;
+    size_t run;
+    int    notify;
 
     while(written < len)
     {
-        cons = xenstore_buf->req_cons;
-        prod = xenstore_buf->req_prod;
-        mb();
-
-        if((prod - cons) >= XENSTORE_RING_SIZE)
+        /* Spins while the ring is full. xenstored rechecks the ring after
+         * each message, so it only needs an event if it had already consumed
+         * everything before this chunk. */
+        run = xen_ring_write(&xs_req_ring, (const char *)data + written,
+            len - written, &notify);
+        if(notify)
         {
-            /* Buffer is full, try again */
-            continue;
+            notify_evtch(xenstore_evtch);
         }
 
-        while(((prod - cons) < XENSTORE_RING_SIZE) && (written < len))
+        if(run == 0 && xs_can_lock())
         {
-            xenstore_buf->req[MASK_XENSTORE_IDX(prod)] = ((const char*)data)[written];
-            prod++;
-            written++;
+            /* Let the reader task drain responses, xenstored may be waiting
+             * for room to answer before it takes more requests */
+            vTaskDelay(1);
         }
-
-        wmb();
-        xenstore_buf->req_prod = prod;
-
-        wmb();
-        notify_evtch(xenstore_evtch);
+        written += run;
     }
 
     return;
 }
 
-static void read_rsp_buf(void * data, size_t len)
+/* With block set the calling task sleeps until the xenstore event instead of
+ * spinning on an empty ring. Only the reader task may do that. data NULL
+ * skips over the bytes. */
+static void read_rsp_buf(void * data, size_t len, int block)
 {
-    XENSTORE_RING_IDX cons;
-    XENSTORE_RING_IDX prod;
     size_t read = 0;
-    size_t skip;
+    size_t run;
+    int    notify;
 
     while(read < len)
     {
-        cons = xenstore_buf->rsp_cons;
-        prod = xenstore_buf->rsp_prod;
-        mb();
-
-        if(cons == prod)
+        /* xenstored writes partial messages, so it only stalls on a full
+         * ring */
+        run = xen_ring_read(&xs_rsp_ring,
+            (data != NULL) ? (char *)data + read : NULL, len - read, 1, &notify);
+        if(notify)
         {
-            /* Buffer is empty, try again */
-            continue;
+            notify_evtch(xenstore_evtch);
         }
 
-        if(data != NULL)
-        {
-            /* Copy from the ring buffer */
-            while((cons != prod) && (read < len))
-            {
-                ((char *)data)[read] = xenstore_buf->rsp[MASK_XENSTORE_IDX(cons)];
-                cons++;
-                read++;
-            }
-        }
-        else
+        if(run == 0 && block)
         {
-            /* Skip over the data in the ring buffer */
-            skip = MIN(len - read, prod - cons);
-            cons += skip;
-            read += skip;
+            /* Buffer is empty, wait for xenstored */
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         }
+        read += run;
+    }
+
+    return;
+}
+
+/* Responses are read by the reader task once it runs, before that by whoever
+ * is waiting for one */
+static int xs_task_mode(void)
+{
+    return xs_task != NULL && xen_can_block();
+}
 
-        mb();
-        xenstore_buf->rsp_cons = cons;
+/* Several tasks may use xenstore at once once the scheduler runs. Before
+ * that there is only one caller, and interrupts do not use it. */
+static int xs_can_lock(void)
+{
+    return xen_can_block();
+}
 
-        wmb();
-        notify_evtch(xenstore_evtch);
+/* Returns 1 once lock is held, or if no lock is needed */
+static int xs_lock(SemaphoreHandle_t lock, TickType_t ticks)
+{
+    if(!xs_can_lock())
+    {
+        return 1;
     }
 
-    return;
+    return xSemaphoreTake(lock, ticks) == pdTRUE;
 }
 
-static int send_request(enum xsd_sockmsg_type type,
-    xenbus_transaction_t trans_id, write_req_t* req, size_t nr_reqs,
-    struct xsd_sockmsg * resp)
+static void xs_unlock(SemaphoreHandle_t lock)
 {
-    int                index;
-    struct xsd_sockmsg msg;
+    if(xs_can_lock())
+    {
+        xSemaphoreGive(lock);
+    }
+}
 
-    /* Build request header */
-    xenstore_req_id++;
+/* Takes a free request slot, waiting up to slot_wait for one, writes the
+ * request and returns the slot. The response is handed to cb in the reader
+ * task, or kept for xs_wait() if cb is NULL. buf, if given, receives the
+ * response payload instead of a new allocation. */
+static int xs_submit(enum xsd_sockmsg_type type,
+    xenbus_transaction_t trans_id, const write_req_t * req, size_t nr_reqs,
+    xenstore_callback_t cb, void * arg, char * buf, size_t buf_len,
+    TickType_t slot_wait)
+{
+    struct xsd_sockmsg  msg;
+    struct xs_request * slot = NULL;
+    size_t              index;
+    int                 i;
 
     msg.type   = type;
-    msg.req_id = xenstore_req_id;
     msg.tx_id  = trans_id;
     msg.len    = 0;
 
@@ -195,333 +386,1374 @@ static int send_request(enum xsd_sockmsg_type type,
         return -1;
     }
 
-    /* Write the request header and payload */
-    write_req_buf(&msg, sizeof(msg));
-    for(index = 0; index < nr_reqs; index++)
+    /* Counts the free slots, so taking it guarantees one below */
+    if(xSemaphoreTake(xs_free_slots, xs_can_lock() ? slot_wait : 0) != pdTRUE)
     {
-        write_req_buf(req[index].data, req[index].len);
+        return -1;
     }
 
-    /* Wait for the response */
-    while(1)
+    taskENTER_CRITICAL();
+    for(i = 0; i < XENSTORE_MAX_PENDING; i++)
     {
-        /* Read message header */
-        read_rsp_buf(resp, sizeof(struct xsd_sockmsg));
-        if(resp->req_id == xenstore_req_id && resp->type != XS_WATCH_EVENT)
+        if(xs_requests[i].state == XS_REQ_FREE)
         {
-            /* Received expected response */
+            slot = &xs_requests[i];
+            slot->req_id = REQ_ID(++xenstore_req_seq, i);
+            slot->state = XS_REQ_PENDING;
             break;
         }
-
-        /* Unexpected message, skip over message payload */
-        read_rsp_buf(NULL, resp->len);
     }
+    taskEXIT_CRITICAL();
 
-    return 0;
-}
-
-static int get_hv_param(int paramid, uint64_t * value)
-{
-    xen_hvm_param_t hvmParam;
-
-    hvmParam.domid = DOMID_SELF;
-    hvmParam.index = paramid;
-
-    if(HYPERVISOR_hvm_op(HVMOP_get_param, &hvmParam) != 0)
+    if(slot == NULL)
     {
         return -1;
     }
 
-    *value = hvmParam.value;
-
-    return 0;
-}
-
-
-/******** Public Functions ****************************************************/
-int xenstore_transaction_start(xenbus_transaction_t * trans_id)
-{
-    int                retval = -1;
-    write_req_t        payload = { "", 1 }; /* Null payload */
-    struct xsd_sockmsg resp;
-    char *             data = NULL;
-
-    /* Send a request and wait for the response */
-    if(send_request(XS_TRANSACTION_START, XBT_NIL, &payload, 1, &resp) != 0)
-    {
-        goto exit;
-    }
-
-    /* Allocate buffer and read response into it */
-    data = malloc(resp.len + 1); /* +1 for null char */
-    if(data == NULL)
-    {
-        read_rsp_buf(NULL, resp.len);
-        goto exit;
-    }
-
-    read_rsp_buf(data, resp.len);
-    data[resp.len] = '\0';
-
-    if(resp.type == XS_ERROR)
+    slot->cb      = cb;
+    slot->arg     = arg;
+    slot->body    = NULL;
+    slot->buf     = buf;
+    slot->buf_len = buf_len;
+    slot->err     = 0;
+    if(xs_done != NULL)
     {
-        /* xenstore responded with an error */
-        goto exit;
+        xEventGroupClearBits(xs_done, 1 << i);
     }
+    wmb();
 
-    /* Read the transaction ID */
-    if(sscanf(data, "%u", trans_id) != 1)
+    /* Write the request header and payload, in one piece on the ring */
+    msg.req_id = slot->req_id;
+    xs_lock(xs_write_lock, portMAX_DELAY);
+    write_req_buf(&msg, sizeof(msg));
+    for(index = 0; index < nr_reqs; index++)
     {
-        goto exit;
+        write_req_buf(req[index].data, req[index].len);
     }
+    xs_unlock(xs_write_lock);
 
-    retval = 0;
-
-exit:
-    free(data);
-
-    return retval;
+    return i;
 }
 
-int xenstore_transaction_end(xenbus_transaction_t trans_id,
-    int abort, int * again)
+/* Reads one message from the response ring and hands it to its request */
+static void xs_read_message(int block)
 {
-    int                retval = -1;
-    write_req_t        payload;
-    struct xsd_sockmsg resp;
-    char *             data = NULL;
+    struct xsd_sockmsg  msg;
+    struct xs_request * req;
+    char *              body;
 
-    *again = 0;
-
-    payload.data = abort ? "F" : "T";
-    payload.len  = strlen(payload.data) + 1; /* +1 for null char */
+    read_rsp_buf(&msg, sizeof(msg), block);
 
-    /* Send a request and wait for the response */
-    if(send_request(XS_TRANSACTION_END, trans_id, &payload, 1, &resp) != 0)
+    if(msg.type == XS_WATCH_EVENT)
     {
-        goto exit;
+        xs_queue_watch_event(&msg, block);
+        return;
     }
 
-    /* Allocate buffer and read response into it */
-    data = malloc(resp.len + 1); /* +1 for null char */
-    if(data == NULL)
+    req = &xs_requests[REQ_ID_SLOT(msg.req_id) % XENSTORE_MAX_PENDING];
+    if(req->state != XS_REQ_PENDING || req->req_id != msg.req_id)
     {
-        read_rsp_buf(NULL, resp.len);
-        goto exit;
+        /* Not for a request in flight, skip over message payload */
+        read_rsp_buf(NULL, msg.len, block);
+        return;
     }
 
-    read_rsp_buf(data, resp.len);
-    data[resp.len] = '\0';
+    req->rsp = msg;
 
-    if(resp.type == XS_ERROR)
+    if(req->buf != NULL && msg.len < req->buf_len)
     {
-        if(strcmp(data, "EAGAIN") == 0)
-        {
-            /* Transaction needs to be repeated */ 
-            *again = 1;
-            retval = 0;
-        }
-        else
-        {
-            /* Unknown error */
-            retval = -1;
-        }
+        body = req->buf;
+    }
+    else if(req->buf != NULL)
+    {
+        /* Does not fit in the caller's buffer */
+        body = NULL;
     }
     else
     {
-        /* Success */
-        retval = 0;
+        body = malloc(msg.len + 1); /* +1 for null char */
     }
 
-exit:
-    free(data);
+    if(body == NULL)
+    {
+        read_rsp_buf(NULL, msg.len, block);
+        req->err = -1;
+    }
+    else
+    {
+        read_rsp_buf(body, msg.len, block);
+        body[msg.len] = '\0';
+        req->err = (msg.type == XS_ERROR) ? -1 : 0;
+    }
 
-    return retval;
+    req->body = body;
+    xs_complete(req);
 }
 
-char * xenstore_read(xenbus_transaction_t trans_id, const char * dir,
-    const char * node, size_t * len)
+/* Passes a watch event to the watch task, so the callback is free to make
+ * xenstore requests of its own. Events are dropped until the task exists. */
+static void xs_queue_watch_event(struct xsd_sockmsg * msg, int block)
 {
-    char *             retval = NULL;
-    char *             path = NULL;
-    write_req_t        payload;
-    struct xsd_sockmsg resp;
+    struct xs_watch_event event;
 
-    path = path_join(dir, node);
-    if(path == NULL)
+    event.len = msg->len;
+    event.body = (xs_watch_queue != NULL) ? malloc(msg->len + 1) : NULL;
+    if(event.body == NULL)
     {
-        goto exit;
+        read_rsp_buf(NULL, msg->len, block);
+        return;
     }
 
-    /* Send a request and wait for the response */
-    payload.data = path;
-    payload.len = strlen(path) + 1; /* +1 for null char */
-    if(send_request(XS_READ, trans_id, &payload, 1, &resp) != 0)
+    read_rsp_buf(event.body, msg->len, block);
+    event.body[msg->len] = '\0';
+
+    if(xQueueSend(xs_watch_queue, &event, 0) != pdTRUE)
     {
-        goto exit;
+        free(event.body);
     }
+}
 
-    /* After this point, the response must be read */
+static void xs_complete(struct xs_request * req)
+{
+    xenstore_callback_t cb;
+    int slot = req - xs_requests;
 
-    if(resp.type == XS_ERROR)
+    taskENTER_CRITICAL();
+    cb = req->cb;
+    if(cb == NULL)
     {
-        /* xenstore responded with an error, skip over the response data */
-        read_rsp_buf(NULL, resp.len);
-        goto exit;
+        req->state = XS_REQ_DONE;
     }
+    taskEXIT_CRITICAL();
 
-    if(len != NULL)
+    if(cb != NULL)
     {
-        *len = resp.len;
+        cb(req->arg, req->err, req->body, req->rsp.len);
+        xs_release(req);
     }
-
-    /* Allocate buffer and read response into it */
-    retval = malloc(resp.len + 1); /* +1 for null char */
-    if(retval == NULL)
+    else if(xs_done != NULL)
     {
-        read_rsp_buf(NULL, resp.len);
-        goto exit;
+        xEventGroupSetBits(xs_done, 1 << slot);
     }
-
-    read_rsp_buf(retval, resp.len);
-
-    /* Value can be binary or ascii data - null terminate in case of ascii data */
-    retval[resp.len] = '\0';
-
-exit:
-    free(path);
-
-    return retval;
 }
 
-int xenstore_read_int(xenbus_transaction_t trans_id, const char * dir,
-    const char * node)
+/* Waits for a request without a callback to complete. Returns -1 on timeout,
+ * in which case the response is thrown away whenever it arrives. */
+static int xs_wait(int slot, TickType_t ticks)
 {
-    char * strval = NULL;
-    int retval = -1;
+    struct xs_request * req = &xs_requests[slot];
+    int done;
 
-    strval = xenstore_read(trans_id, dir, node, NULL);
-    if(strval == NULL)
+    while(req->state != XS_REQ_DONE)
     {
-        goto exit;
-    }
+        if(!xs_task_mode())
+        {
+            /* Nobody else reads the ring, so do it here. Another waiter may
+             * be reading it already, and may deliver this response. */
+            if(xs_lock(xs_read_lock, 1))
+            {
+                if(req->state != XS_REQ_DONE)
+                {
+                    xs_read_message(0);
+                }
+                xs_unlock(xs_read_lock);
+            }
+            continue;
+        }
 
-    sscanf(strval, "%d", &retval);
+        if((xEventGroupWaitBits(xs_done, 1 << slot, pdTRUE, pdTRUE, ticks) & (1 << slot)) == 0)
+        {
+            taskENTER_CRITICAL();
+            done = (req->state == XS_REQ_DONE);
+            if(!done)
+            {
+                req->cb = xs_discard;
+            }
+            taskEXIT_CRITICAL();
 
-exit:
-    free(strval);
+            if(!done)
+            {
+                return -1;
+            }
+        }
+    }
+    rmb();
 
-    return retval;
+    return 0;
 }
 
-int xenstore_write(xenbus_transaction_t trans_id, const char * dir,
-    const char * node, const char * value, size_t len)
+static void xs_release(struct xs_request * req)
 {
-    int                retval = -1;
-    char *             path = NULL;
-    write_req_t        payload[2];
-    struct xsd_sockmsg resp;
-
-    path = path_join(dir, node);
-    if(path == NULL)
+    if(req->body != req->buf)
     {
-        goto exit;
+        free(req->body);
     }
+    req->body = NULL;
+    req->cb = NULL;
+    wmb();
+    req->state = XS_REQ_FREE;
+    xSemaphoreGive(xs_free_slots);
+}
 
-    /* Send a request and wait for the response */
-    payload[0].data = path;
-    payload[0].len  = strlen(path) + 1; /* +1 for null char */
-    payload[1].data = value;
-    payload[1].len  = len;
+/* Callback for requests whose waiter gave up */
+static void xs_discard(void * arg, int err, char * data, size_t len)
+{
+}
 
-    if(send_request(XS_WRITE, trans_id, payload, 2, &resp) != 0)
-    {
-        goto exit;
-    }
+/* Sends a request and waits for the response. The payload is put in buf if
+ * given, otherwise in an allocation the caller frees. Returns -1 if the
+ * response was lost or did not fit, resp is valid if it arrived. */
+static int send_request(enum xsd_sockmsg_type type,
+    xenbus_transaction_t trans_id, write_req_t* req, size_t nr_reqs,
+    struct xsd_sockmsg * resp, char ** body, char * buf, size_t buf_len)
+{
+    struct xs_request * slot;
+    int                 index;
 
-    /* After this point, the response must be read */
+    *body = NULL;
 
-    if(resp.type == XS_ERROR)
+    index = xs_submit(type, trans_id, req, nr_reqs, NULL, NULL, buf, buf_len,
+        portMAX_DELAY);
+    if(index < 0)
     {
-        /* xenstore responded with an error */
-        read_rsp_buf(NULL, resp.len);
-        goto exit;
+        return -1;
     }
 
-    /* Read the response, should be "OK" */
-    read_rsp_buf(NULL, resp.len);
-
-    retval = 0;
+    /* Wait for the response */
+    xs_wait(index, portMAX_DELAY);
 
-exit:
-    free(path);
+    /* Hand the payload over to the caller */
+    slot = &xs_requests[index];
+    *resp = slot->rsp;
+    *body = slot->body;
+    slot->body = NULL;
+    xs_release(slot);
 
-    return retval;
+    return (*body != NULL) ? 0 : -1;
 }
 
-int xenstore_printf(xenbus_transaction_t trans_id, const char * dir,
-    const char * node, const char* format, ...)
+static void xenstore_handle_event(void * data)
 {
-    int     retval = 0;
-    char *  value = NULL;
-    int     size;
-    va_list args;
+    BaseType_t woken = pdFALSE;
 
-    va_start(args, format);
-    size = vsnprintf(NULL, 0, format, args);
-    va_end(args);
+    if(xs_task == NULL)
+    {
+        /* xenstore_start_task() has not created the task yet, or failed to */
+        return;
+    }
 
-    if(size < 0)
+    if(xen_in_isr())
     {
-        retval = -1;
-        goto exit;
+        vTaskNotifyGiveFromISR(xs_task, &woken);
+        portYIELD_FROM_ISR(woken);
     }
+    else
+    {
+        xTaskNotifyGive(xs_task);
+    }
+}
 
-    value = malloc(size + 1);
-    if(value == NULL)
+/* Routes every response to the request it belongs to */
+static void xenstore_task(void * arg)
+{
+    for(;;)
     {
-        retval = -1;
-        goto exit;
+        /* Taken in case a waiter that has not seen this task yet is still
+         * polling the ring */
+        xs_lock(xs_read_lock, portMAX_DELAY);
+        xs_read_message(1);
+        xs_unlock(xs_read_lock);
     }
+}
 
-    va_start(args, format);
-    retval = vsnprintf(value, size + 1, format, args);
-    va_end(args);
+/* Calls the callback of the watch each event belongs to */
+static void xenstore_watch_task(void * arg)
+{
+    struct xs_watch_event event;
+    const char *          path;
+    const char *          token;
+    size_t                path_len;
+    int                   i;
 
-    if(xenstore_write(trans_id, dir, node, value, strlen(value)) != 0)
+    for(;;)
     {
-        retval = -1;
-        goto exit;
-    }
+        xQueueReceive(xs_watch_queue, &event, portMAX_DELAY);
 
-exit:
-    free(value);
+        path = event.body;
+        path_len = strlen(path);
+        token = (path_len < event.len) ? path + path_len + 1 : "";
 
-    return retval;
+        for(i = 0; i < XENSTORE_MAX_WATCHES; i++)
+        {
+            /* Marked busy together with the used check, so that
+             * xenstore_unwatch() either sees the call or stops it */
+            taskENTER_CRITICAL();
+            if(xs_watches[i].used == 1 && strcmp(xs_watches[i].token, token) == 0)
+            {
+                xs_watches[i].busy = 1;
+            }
+            taskEXIT_CRITICAL();
+
+            if(xs_watches[i].busy)
+            {
+                xs_watches[i].cb(xs_watches[i].arg, path, token);
+                wmb();
+                xs_watches[i].busy = 0;
+                break;
+            }
+        }
+
+        free(event.body);
+    }
 }
 
-void xenstore_init(void)
+static void cache_watch_cb(void * arg, const char * path, const char * token)
 {
-    uint64_t param;
+    struct xs_cache_entry * entry = arg;
 
-    /* Set up event channel with Xen store */
-    if(get_hv_param(HVM_PARAM_STORE_EVTCHN, &param) != 0)
+    xSemaphoreTake(xs_cache_lock, portMAX_DELAY);
+    if(entry->initial)
     {
-        printk("error getting HVM_PARAM_STORE_EVTCHN parameter\r\n");
-        return;
+        /* Reflects the store from before anything was read through the entry */
+        entry->initial = 0;
+    }
+    else
+    {
+        entry->gen++;
+        if(entry->valid)
+        {
+            entry->valid = 0;
+            xs_cache_stats.invalidations++;
+        }
     }
+    xSemaphoreGive(xs_cache_lock);
+}
 
-    xenstore_evtch = (evtchn_port_t) param;
+/* Finds or sets up the entry for path ahead of a read from xenstore, and the
+ * generation the value read has to be stored against. Returns NULL if the
+ * path cannot be cached. */
+static struct xs_cache_entry * cache_claim(const char * path, uint32_t * gen)
+{
+    struct xs_cache_entry * entry = NULL;
+    struct xs_cache_entry * victim = NULL;
+    int                     old_watch = -1;
+    int                     i;
 
-    /* Set up the shared memory ring buffer with Xen store */
-    if(get_hv_param(HVM_PARAM_STORE_PFN, &param) != 0)
+    if(strlen(path) >= XENSTORE_CACHE_PATH_MAX)
     {
-        printk("error getting HVM_PARAM_STORE_PFN parameter\r\n");        
-        return;
+        return NULL;
+    }
+
+    xSemaphoreTake(xs_cache_lock, portMAX_DELAY);
+    for(i = 0; i < XENSTORE_CACHE_ENTRIES; i++)
+    {
+        if(xs_cache[i].state == CACHE_LIVE && strcmp(xs_cache[i].path, path) == 0)
+        {
+            entry = &xs_cache[i];
+            break;
+        }
+
+        /* A free entry, or else the least recently used */
+        if(xs_cache[i].state == CACHE_FREE)
+        {
+            if(victim == NULL || victim->state != CACHE_FREE)
+            {
+                victim = &xs_cache[i];
+            }
+        }
+        else if(xs_cache[i].state == CACHE_LIVE &&
+                (victim == NULL || (victim->state == CACHE_LIVE &&
+                 (int32_t)(xs_cache[i].last_use - victim->last_use) < 0)))
+        {
+            victim = &xs_cache[i];
+        }
+    }
+
+    if(entry != NULL)
+    {
+        *gen = entry->gen;
+        xSemaphoreGive(xs_cache_lock);
+        return entry;
+    }
+
+    if(victim == NULL)
+    {
+        xSemaphoreGive(xs_cache_lock);
+        return NULL;
+    }
+
+    if(victim->state == CACHE_LIVE)
+    {
+        old_watch = victim->watch;
+        xs_cache_stats.evictions++;
+    }
+    victim->state = CACHE_BUSY;
+    victim->valid = 0;
+    xSemaphoreGive(xs_cache_lock);
+
+    /* Move the entry's watch over to the new path */
+    if(old_watch >= 0)
+    {
+        xenstore_unwatch(old_watch);
+    }
+
+    strcpy(victim->path, path);
+    victim->initial = 1;
+    victim->gen = 0;
+    victim->last_use = xs_cache_clock;
+    victim->watch = xenstore_watch(path, cache_watch_cb, victim);
+
+    xSemaphoreTake(xs_cache_lock, portMAX_DELAY);
+    victim->state = (victim->watch >= 0) ? CACHE_LIVE : CACHE_FREE;
+    *gen = victim->gen;
+    xSemaphoreGive(xs_cache_lock);
+
+    return (victim->watch >= 0) ? victim : NULL;
+}
+
+/* Returns a copy of the cached value of path, in buf if given, or NULL on a
+ * miss */
+static char * cache_lookup(const char * path, char * buf, size_t buf_len,
+    size_t * len)
+{
+    char * value = NULL;
+    int    i;
+
+    xSemaphoreTake(xs_cache_lock, portMAX_DELAY);
+    for(i = 0; i < XENSTORE_CACHE_ENTRIES; i++)
+    {
+        if(xs_cache[i].state == CACHE_LIVE && xs_cache[i].valid &&
+           strcmp(xs_cache[i].path, path) == 0)
+        {
+            if(buf == NULL)
+            {
+                value = malloc(xs_cache[i].len + 1); /* +1 for null char */
+            }
+            else if(xs_cache[i].len < buf_len)
+            {
+                value = buf;
+            }
+
+            if(value != NULL)
+            {
+                memcpy(value, xs_cache[i].value, xs_cache[i].len);
+                value[xs_cache[i].len] = '\0';
+                if(len != NULL)
+                {
+                    *len = xs_cache[i].len;
+                }
+                xs_cache[i].last_use = ++xs_cache_clock;
+            }
+            break;
+        }
+    }
+
+    if(value != NULL)
+    {
+        xs_cache_stats.hits++;
+    }
+    else
+    {
+        xs_cache_stats.misses++;
+    }
+    xSemaphoreGive(xs_cache_lock);
+
+    return value;
+}
+
+/* Stores a value read from xenstore, unless the path changed after gen */
+static void cache_fill(struct xs_cache_entry * entry, uint32_t gen,
+    const char * value, size_t len)
+{
+    if(len > XENSTORE_CACHE_VALUE_MAX)
+    {
+        return;
+    }
+
+    xSemaphoreTake(xs_cache_lock, portMAX_DELAY);
+    if(entry->state == CACHE_LIVE && entry->gen == gen)
+    {
+        memcpy(entry->value, value, len);
+        entry->len = len;
+        entry->valid = 1;
+        entry->last_use = ++xs_cache_clock;
+    }
+    xSemaphoreGive(xs_cache_lock);
+}
+
+/* Drops the cached value of a path this guest writes, without waiting for
+ * the watch to fire */
+static void cache_invalidate(const char * path)
+{
+    int i;
+
+    xSemaphoreTake(xs_cache_lock, portMAX_DELAY);
+    for(i = 0; i < XENSTORE_CACHE_ENTRIES; i++)
+    {
+        if(xs_cache[i].state == CACHE_LIVE && strcmp(xs_cache[i].path, path) == 0)
+        {
+            xs_cache[i].gen++;
+            if(xs_cache[i].valid)
+            {
+                xs_cache[i].valid = 0;
+                xs_cache_stats.invalidations++;
+            }
+        }
+    }
+    xSemaphoreGive(xs_cache_lock);
+}
+
+/* Reads dir/node into buf, or into an allocation if buf is NULL. If the value
+ * does not fit in buf, returns NULL with *len set to its length. The read
+ * cache is skipped unless cached is set. */
+static char * xs_read(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, size_t * len, int cached)
+{
+    char *                  retval = NULL;
+    write_req_t             payload[PATH_SEGS_MAX];
+    size_t                  nr_segs;
+    struct xsd_sockmsg      resp;
+    struct xs_cache_entry * entry = NULL;
+    uint32_t                gen = 0;
+    char                    path[XENSTORE_CACHE_PATH_MAX];
+
+    /* Reads in a transaction must see the transaction's view of the store */
+    if(cached && xs_cache_enabled && trans_id == XBT_NIL &&
+       path_print(path, sizeof(path), dir, node) == 0)
+    {
+        retval = cache_lookup(path, buf, buf_len, len);
+        if(retval != NULL)
+        {
+            return retval;
+        }
+
+        entry = cache_claim(path, &gen);
+    }
+
+    /* Send a request and wait for the response */
+    resp.type = XS_ERROR;
+    nr_segs = path_segs(dir, node, payload);
+    if(send_request(XS_READ, trans_id, payload, nr_segs, &resp, &retval,
+        buf, buf_len) != 0)
+    {
+        if(resp.type == XS_READ && len != NULL)
+        {
+            /* Too big for the caller's buffer */
+            *len = resp.len;
+        }
+        return NULL;
+    }
+
+    if(resp.type == XS_ERROR)
+    {
+        /* xenstore responded with an error */
+        if(retval != buf)
+        {
+            free(retval);
+        }
+        return NULL;
+    }
+
+    /* Value can be binary or ascii data, it is null terminated in case of
+     * ascii data */
+    if(len != NULL)
+    {
+        *len = resp.len;
+    }
+
+    if(entry != NULL)
+    {
+        cache_fill(entry, gen, retval, resp.len);
+    }
+
+    return retval;
+}
+
+/* Reads the keys with up to XENSTORE_MAX_PENDING requests in flight at a
+ * time, returns the number found or -1 if the requests could not be sent */
+static int xs_gather(xenbus_transaction_t trans_id, const char * dir,
+    xenstore_gather_t * keys, size_t nr_keys)
+{
+    write_req_t         payload[PATH_SEGS_MAX];
+    size_t              nr_segs;
+    int                 handles[XENSTORE_MAX_PENDING];
+    size_t              submitted = 0;
+    size_t              collected = 0;
+    struct xs_request * req;
+    xenstore_gather_t * key;
+    int                 found = 0;
+    int                 slot;
+
+    while(collected < nr_keys)
+    {
+        /* Fill the pipeline. Only the first request may wait for a slot,
+         * the others would wait on slots this call holds itself. */
+        while(submitted < nr_keys &&
+              submitted - collected < XENSTORE_MAX_PENDING)
+        {
+            key = &keys[submitted];
+            nr_segs = path_segs(dir, key->node, payload);
+            slot = xs_submit(XS_READ, trans_id, payload, nr_segs, NULL, NULL,
+                key->buf, key->buf_len,
+                (submitted == collected) ? portMAX_DELAY : 0);
+            if(slot < 0)
+            {
+                if(submitted == collected)
+                {
+                    return -1;
+                }
+                break;
+            }
+
+            handles[submitted % XENSTORE_MAX_PENDING] = slot;
+            submitted++;
+        }
+
+        /* Collect the oldest response */
+        key = &keys[collected];
+        slot = handles[collected % XENSTORE_MAX_PENDING];
+        xs_wait(slot, portMAX_DELAY);
+
+        req = &xs_requests[slot];
+        key->err = (req->body != NULL && req->err == 0) ? 0 : -1;
+        if(key->err == 0)
+        {
+            key->len = req->rsp.len;
+            found++;
+        }
+        else
+        {
+            /* The length needed if the value did not fit, never the length of
+             * an XS_ERROR string */
+            key->len = (req->rsp.type == XS_READ && req->body == NULL) ?
+                req->rsp.len : 0;
+            key->buf[0] = '\0';
+        }
+        xs_release(req);
+        collected++;
+    }
+
+    return found;
+}
+
+/* Formats a value into buf and writes it, returns its length or -1 */
+static int xs_vprintf(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, const char * format,
+    va_list args)
+{
+    int size;
+
+    size = vsnprintf(buf, buf_len, format, args);
+    if(size < 0 || (size_t)size >= buf_len)
+    {
+        return -1;
+    }
+
+    if(xenstore_write(trans_id, dir, node, buf, size) != 0)
+    {
+        return -1;
+    }
+
+    return size;
+}
+
+static int get_hv_param(int paramid, uint64_t * value)
+{
+    xen_hvm_param_t hvmParam;
+
+    hvmParam.domid = DOMID_SELF;
+    hvmParam.index = paramid;
+
+    if(HYPERVISOR_hvm_op(HVMOP_get_param, &hvmParam) != 0)
+    {
+        return -1;
+    }
+
+    *value = hvmParam.value;
+
+    return 0;
+}
+
+
+/******** Public Functions ****************************************************/
+int xenstore_transaction_start(xenbus_transaction_t * trans_id)
+{
+    write_req_t        payload = { "", 1 }; /* Null payload */
+    struct xsd_sockmsg resp;
+    char               status[XS_STATUS_LEN];
+    char *             data;
+
+    /* Send a request and wait for the response */
+    if(send_request(XS_TRANSACTION_START, XBT_NIL, &payload, 1, &resp, &data,
+        status, sizeof(status)) != 0)
+    {
+        return -1;
+    }
+
+    if(resp.type == XS_ERROR)
+    {
+        /* xenstore responded with an error */
+        return -1;
+    }
+
+    /* Read the transaction ID */
+    if(sscanf(data, "%u", trans_id) != 1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int xenstore_transaction_end(xenbus_transaction_t trans_id,
+    int abort, int * again)
+{
+    int                retval = -1;
+    write_req_t        payload;
+    struct xsd_sockmsg resp;
+    char               status[XS_STATUS_LEN];
+    char *             data;
+
+    *again = 0;
+
+    payload.data = abort ? "F" : "T";
+    payload.len  = strlen(payload.data) + 1; /* +1 for null char */
+
+    /* Send a request and wait for the response */
+    if(send_request(XS_TRANSACTION_END, trans_id, &payload, 1, &resp, &data,
+        status, sizeof(status)) != 0)
+    {
+        return -1;
+    }
+
+    if(resp.type == XS_ERROR)
+    {
+        if(strcmp(data, "EAGAIN") == 0)
+        {
+            /* Transaction needs to be repeated */ 
+            *again = 1;
+            retval = 0;
+        }
+        else
+        {
+            /* Unknown error */
+            retval = -1;
+        }
+    }
+    else
+    {
+        /* Success */
+        retval = 0;
+    }
+
+    return retval;
+}
+
+/* Returns the value of dir/node in an allocation the caller frees */
+char * xenstore_read(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, size_t * len)
+{
+    return xs_read(trans_id, dir, node, NULL, 0, len, 1);
+}
+
+/* Same as xenstore_read(), but always asks xenstore, for callers that must
+ * see a change the read cache may not have caught up with yet */
+char * xenstore_read_uncached(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, size_t * len)
+{
+    return xs_read(trans_id, dir, node, NULL, 0, len, 0);
+}
+
+/*
+ * Reads the value of dir/node into buf, NUL terminated. Returns 0 on success,
+ * or -1 with *len set to the length of the value if it needs a bigger buffer,
+ * or left alone on any other error.
+ */
+int xenstore_read_buf(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, size_t * len)
+{
+    if(buf == NULL || buf_len == 0)
+    {
+        return -1;
+    }
+
+    return (xs_read(trans_id, dir, node, buf, buf_len, len, 1) != NULL) ? 0 : -1;
+}
+
+int xenstore_read_int(xenbus_transaction_t trans_id, const char * dir,
+    const char * node)
+{
+    char value[XS_STATUS_LEN];
+    int  retval = -1;
+
+    if(xs_read(trans_id, dir, node, value, sizeof(value), NULL, 1) != NULL)
+    {
+        sscanf(value, "%d", &retval);
+    }
+
+    return retval;
+}
+
+int xenstore_write(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, const char * value, size_t len)
+{
+    write_req_t        payload[PATH_SEGS_MAX + 1];
+    size_t             nr_segs;
+    struct xsd_sockmsg resp;
+    char               status[XS_STATUS_LEN];
+    char               path[XENSTORE_CACHE_PATH_MAX];
+    char *             data;
+
+    nr_segs = path_segs(dir, node, payload);
+    payload[nr_segs].data  = value;
+    payload[nr_segs++].len = len;
+
+    /* Paths too long to print here are never cached */
+    if(xs_cache_enabled && path_print(path, sizeof(path), dir, node) == 0)
+    {
+        cache_invalidate(path);
+    }
+
+    /* Send a request and wait for the response */
+    if(send_request(XS_WRITE, trans_id, payload, nr_segs, &resp, &data,
+        status, sizeof(status)) != 0)
+    {
+        return -1;
+    }
+
+    if(resp.type == XS_ERROR)
+    {
+        /* xenstore responded with an error */
+        return -1;
+    }
+
+    /* The response should be "OK" */
+    return 0;
+}
+
+/* Formats values of up to XENSTORE_PRINTF_STACK bytes on the stack, longer
+ * ones in a temporary allocation */
+int xenstore_printf(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, const char* format, ...)
+{
+    int     retval;
+    char    stack_value[XENSTORE_PRINTF_STACK];
+    char *  value = NULL;
+    int     size;
+    va_list args;
+
+    va_start(args, format);
+    size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if(size < 0)
+    {
+        return -1;
+    }
+
+    if((size_t)size < sizeof(stack_value))
+    {
+        va_start(args, format);
+        retval = xs_vprintf(trans_id, dir, node, stack_value, sizeof(stack_value),
+            format, args);
+        va_end(args);
+
+        return retval;
+    }
+
+    value = malloc(size + 1);
+    if(value == NULL)
+    {
+        return -1;
+    }
+
+    va_start(args, format);
+    retval = xs_vprintf(trans_id, dir, node, value, size + 1, format, args);
+    va_end(args);
+
+    free(value);
+
+    return retval;
+}
+
+/* Like xenstore_printf(), formatting into the caller's buffer. Returns -1 if
+ * the value does not fit. */
+int xenstore_printf_buf(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, const char * format, ...)
+{
+    int     retval;
+    va_list args;
+
+    va_start(args, format);
+    retval = xs_vprintf(trans_id, dir, node, buf, buf_len, format, args);
+    va_end(args);
+
+    return retval;
+}
+
+/*
+ * Sends a request without waiting for the response, so several can be in
+ * flight at once. The payload is the concatenation of the segments. If cb is
+ * given it is called with the response from the reader task, and must not
+ * wait on xenstore itself. Otherwise collect the response with
+ * xenstore_wait(). Returns a request handle, or -1 if the request could not
+ * be sent or XENSTORE_MAX_PENDING requests are already in flight.
+ */
+int xenstore_submit(enum xsd_sockmsg_type type, xenbus_transaction_t trans_id,
+    const xenstore_seg_t * segs, size_t nr_segs, xenstore_callback_t cb,
+    void * arg)
+{
+    return xs_submit(type, trans_id, segs, nr_segs, cb, arg, NULL, 0, 0);
+}
+
+/*
+ * Waits up to timeout_ms for the response to a request submitted without a
+ * callback. On success *data is the NUL terminated payload, which the caller
+ * frees, and *len its length. Returns 0 on success, -1 if xenstore answered
+ * with an error (*data then holds the error name) or on timeout, after which
+ * the handle must not be used again.
+ */
+int xenstore_wait(int handle, char ** data, size_t * len, unsigned int timeout_ms)
+{
+    struct xs_request * req;
+    TickType_t          ticks;
+    int                 retval;
+
+    if(handle < 0 || handle >= XENSTORE_MAX_PENDING ||
+       xs_requests[handle].state == XS_REQ_FREE || xs_requests[handle].cb != NULL)
+    {
+        return -1;
+    }
+
+    ticks = (timeout_ms == XENSTORE_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    if(xs_wait(handle, ticks) != 0)
+    {
+        return -1;
+    }
+
+    req = &xs_requests[handle];
+    retval = req->err;
+    if(len != NULL)
+    {
+        *len = req->rsp.len;
+    }
+
+    if(data != NULL)
+    {
+        *data = req->body;
+        req->body = NULL;
+    }
+    xs_release(req);
+
+    return retval;
+}
+
+int xenstore_read_async(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, xenstore_callback_t cb, void * arg)
+{
+    write_req_t payload[PATH_SEGS_MAX];
+    size_t      nr_segs;
+
+    nr_segs = path_segs(dir, node, payload);
+
+    return xs_submit(XS_READ, trans_id, payload, nr_segs, cb, arg, NULL, 0, 0);
+}
+
+int xenstore_write_async(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, const char * value, size_t len,
+    xenstore_callback_t cb, void * arg)
+{
+    write_req_t payload[PATH_SEGS_MAX + 1];
+    size_t      nr_segs;
+
+    nr_segs = path_segs(dir, node, payload);
+    payload[nr_segs].data  = value;
+    payload[nr_segs++].len = len;
+
+    return xs_submit(XS_WRITE, trans_id, payload, nr_segs, cb, arg, NULL, 0, 0);
+}
+
+/*
+ * Lists the children of dir/node. Returns their names back to back, each NUL
+ * terminated, in an allocation the caller frees, with their count in *num.
+ */
+char * xenstore_directory(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, unsigned int * num)
+{
+    write_req_t        payload[PATH_SEGS_MAX];
+    size_t             nr_segs;
+    struct xsd_sockmsg resp;
+    char *             data;
+    uint32_t           index;
+
+    nr_segs = path_segs(dir, node, payload);
+    if(send_request(XS_DIRECTORY, trans_id, payload, nr_segs, &resp, &data,
+        NULL, 0) != 0)
+    {
+        return NULL;
+    }
+
+    if(resp.type == XS_ERROR)
+    {
+        /* xenstore responded with an error */
+        free(data);
+        return NULL;
+    }
+
+    /* Every name ends in a null char */
+    *num = 0;
+    for(index = 0; index < resp.len; index++)
+    {
+        if(data[index] == '\0')
+        {
+            (*num)++;
+        }
+    }
+
+    return data;
+}
+
+/*
+ * Reads several keys under dir in one burst of pipelined requests, inside a
+ * single transaction so the values are consistent. Each key's value goes to
+ * its buf; its err is -1 if the key is missing or the value does not fit,
+ * and len is then the length needed, or 0 for a missing key. Every key needs
+ * a buf. With trans_id XBT_NIL a transaction is started, and repeated if
+ * xenstore asks for that. Returns the number of keys found, or -1.
+ */
+int xenstore_gather(xenbus_transaction_t trans_id, const char * dir,
+    xenstore_gather_t * keys, size_t nr_keys)
+{
+    xenbus_transaction_t own_trans;
+    int                  found;
+    int                  again;
+    size_t               i;
+
+    for(i = 0; i < nr_keys; i++)
+    {
+        if(keys[i].buf == NULL || keys[i].buf_len == 0)
+        {
+            return -1;
+        }
+    }
+
+    if(trans_id != XBT_NIL)
+    {
+        return xs_gather(trans_id, dir, keys, nr_keys);
+    }
+
+    do
+    {
+        if(xenstore_transaction_start(&own_trans) != 0)
+        {
+            return -1;
+        }
+
+        found = xs_gather(own_trans, dir, keys, nr_keys);
+
+        if(xenstore_transaction_end(own_trans, found < 0, &again) != 0)
+        {
+            return -1;
+        }
+    } while(again && found >= 0);
+
+    return found;
+}
+
+/*
+ * Calls cb from the watch task whenever path, or anything below it, changes,
+ * starting with one call as soon as the watch is set. Needs the tasks of
+ * xenstore_start_task() to deliver events, and fails until they run. Returns a
+ * watch handle for xenstore_unwatch(), or -1.
+ */
+int xenstore_watch(const char * path, xenstore_watch_cb_t cb, void * arg)
+{
+    struct xs_watch *  watch = NULL;
+    write_req_t        payload[2];
+    struct xsd_sockmsg resp;
+    char               status[XS_STATUS_LEN];
+    char *             data;
+    int                i;
+
+    if(path == NULL || cb == NULL || xs_watch_queue == NULL || xs_watch_task == NULL)
+    {
+        return -1;
+    }
+
+    taskENTER_CRITICAL();
+    for(i = 0; i < XENSTORE_MAX_WATCHES; i++)
+    {
+        if(!xs_watches[i].used)
+        {
+            watch = &xs_watches[i];
+            watch->used = -1; /* reserved, not matched yet */
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if(watch == NULL)
+    {
+        return -1;
+    }
+
+    watch->path = strdup(path);
+    if(watch->path == NULL)
+    {
+        watch->used = 0;
+        return -1;
+    }
+    watch->cb  = cb;
+    watch->arg = arg;
+    snprintf(watch->token, sizeof(watch->token), "xsw%u",
+        (unsigned int)__atomic_add_fetch(&xs_watch_seq, 1, __ATOMIC_RELAXED));
+    wmb();
+
+    /* Live before the request goes out, xenstored fires the watch at once */
+    watch->used = 1;
+
+    payload[0].data = path;
+    payload[0].len  = strlen(path) + 1; /* +1 for null char */
+    payload[1].data = watch->token;
+    payload[1].len  = strlen(watch->token) + 1;
+
+    if(send_request(XS_WATCH, XBT_NIL, payload, 2, &resp, &data,
+        status, sizeof(status)) != 0 || resp.type == XS_ERROR)
+    {
+        watch->used = 0;
+        free(watch->path);
+        watch->path = NULL;
+        return -1;
+    }
+
+    return i;
+}
+
+/* Removes a watch. Events already queued for it are dropped, and a call of
+ * its callback already under way is waited for, unless made from it. */
+int xenstore_unwatch(int handle)
+{
+    struct xs_watch *  watch;
+    write_req_t        payload[2];
+    struct xsd_sockmsg resp;
+    char               status[XS_STATUS_LEN];
+    char *             data;
+    int                retval = 0;
+
+    if(handle < 0 || handle >= XENSTORE_MAX_WATCHES || xs_watches[handle].used != 1)
+    {
+        return -1;
+    }
+
+    watch = &xs_watches[handle];
+    taskENTER_CRITICAL();
+    watch->used = -1;
+    taskEXIT_CRITICAL();
+
+    /* The caller may free what cb uses once this returns, so wait out a call
+     * already under way. A callback removing its own watch cannot wait. */
+    if(xTaskGetCurrentTaskHandle() != xs_watch_task)
+    {
+        while(watch->busy)
+        {
+            vTaskDelay(1);
+        }
+    }
+
+    payload[0].data = watch->path;
+    payload[0].len  = strlen(watch->path) + 1; /* +1 for null char */
+    payload[1].data = watch->token;
+    payload[1].len  = strlen(watch->token) + 1;
+
+    if(send_request(XS_UNWATCH, XBT_NIL, payload, 2, &resp, &data,
+        status, sizeof(status)) != 0 || resp.type == XS_ERROR)
+    {
+        retval = -1;
+    }
+
+    free(watch->path);
+    watch->path = NULL;
+    wmb();
+    watch->used = 0;
+
+    return retval;
+}
+
+/*
+ * Turns the read cache on or off. While on, xenstore_read() outside a
+ * transaction answers from XENSTORE_CACHE_ENTRIES locally kept values, each
+ * dropped by a watch on its path as soon as it changes. Needs the tasks of
+ * xenstore_start_task().
+ */
+int xenstore_cache_enable(int enable)
+{
+    int watch;
+    int i;
+
+    if(enable)
+    {
+        if(xs_watch_task == NULL)
+        {
+            return -1;
+        }
+
+        if(xs_cache_lock == NULL)
+        {
+            xs_cache_lock = xSemaphoreCreateMutex();
+            if(xs_cache_lock == NULL)
+            {
+                return -1;
+            }
+        }
+
+        xs_cache_enabled = 1;
+        return 0;
+    }
+
+    if(!xs_cache_enabled)
+    {
+        return 0;
+    }
+    xs_cache_enabled = 0;
+
+    for(i = 0; i < XENSTORE_CACHE_ENTRIES; i++)
+    {
+        xSemaphoreTake(xs_cache_lock, portMAX_DELAY);
+        watch = (xs_cache[i].state == CACHE_LIVE) ? xs_cache[i].watch : -1;
+        if(watch >= 0)
+        {
+            xs_cache[i].state = CACHE_BUSY;
+            xs_cache[i].valid = 0;
+        }
+        xSemaphoreGive(xs_cache_lock);
+
+        if(watch >= 0)
+        {
+            xenstore_unwatch(watch);
+            xs_cache[i].state = CACHE_FREE;
+        }
+    }
+
+    return 0;
+}
+
+void xenstore_cache_get_stats(xenstore_cache_stats_t * stats)
+{
+    memcpy(stats, &xs_cache_stats, sizeof(*stats));
+}
+
+/*
+ * Starts the task that reads xenstore responses, woken by the xenstore event
+ * instead of polling, and the task that runs watch callbacks. Requests made
+ * before the scheduler runs still poll for their responses.
+ */
+int xenstore_start_task(unsigned int priority)
+{
+    if(xenstore_buf == NULL || xs_task != NULL)
+    {
+        return -1;
+    }
+
+    xs_done = xEventGroupCreate();
+    if(xs_done == NULL)
+    {
+        goto error;
+    }
+
+    xs_watch_queue = xQueueCreate(XENSTORE_WATCH_QUEUE_LEN, sizeof(struct xs_watch_event));
+    if(xs_watch_queue == NULL ||
+       xTaskCreate(xenstore_watch_task, "xswatch", XENSTORE_TASK_STACK_DEPTH, NULL,
+           (UBaseType_t)priority, &xs_watch_task) != pdPASS)
+    {
+        printk("error starting xenstore watch task\r\n");
+        goto error;
+    }
+
+    /* Registered before xs_task exists, so that no event can be lost
+     * between the task starting and the handler being in place */
+    if(register_event_handler(xenstore_evtch, xenstore_handle_event, NULL) != 0)
+    {
+        printk("error registering xenstore event handler\r\n");
+        goto error;
+    }
+    unmask_evtchn(xenstore_evtch);
+
+    /* Created last: once it runs it may hold xs_read_lock at any time, so
+     * it is never deleted */
+    if(xTaskCreate(xenstore_task, "xenstore", XENSTORE_TASK_STACK_DEPTH, NULL,
+        (UBaseType_t)priority, &xs_task) != pdPASS)
+    {
+        /* The handler stays registered and does nothing while xs_task is
+         * NULL */
+        xs_task = NULL;
+        printk("error starting xenstore task\r\n");
+        goto error;
+    }
+
+    return 0;
+
+error:
+    /* Callers keep polling for responses while xs_task is NULL */
+    if(xs_watch_task != NULL)
+    {
+        vTaskDelete(xs_watch_task);
+        xs_watch_task = NULL;
+    }
+    if(xs_watch_queue != NULL)
+    {
+        vQueueDelete(xs_watch_queue);
+        xs_watch_queue = NULL;
+    }
+    if(xs_done != NULL)
+    {
+        vEventGroupDelete(xs_done);
+        xs_done = NULL;
+    }
+
+    return -1;
+}
+
+void xenstore_init(void)
+{
+    uint64_t param;
+
+    /* Set up event channel with Xen store */
+    if(get_hv_param(HVM_PARAM_STORE_EVTCHN, &param) != 0)
+    {
+        printk("error getting HVM_PARAM_STORE_EVTCHN parameter\r\n");
+        return;
+    }
+
+    xenstore_evtch = (evtchn_port_t) param;
+
+    /* Set up the shared memory ring buffer with Xen store */
+    if(get_hv_param(HVM_PARAM_STORE_PFN, &param) != 0)
+    {
+        printk("error getting HVM_PARAM_STORE_PFN parameter\r\n");        
+        return;
+    }
+
+    xs_write_lock = xSemaphoreCreateMutex();
+    xs_read_lock = xSemaphoreCreateMutex();
+    xs_free_slots = xSemaphoreCreateCounting(XENSTORE_MAX_PENDING, XENSTORE_MAX_PENDING);
+    if(xs_write_lock == NULL || xs_read_lock == NULL || xs_free_slots == NULL)
+    {
+        printk("error creating xenstore locks\r\n");
+        return;
     }
 
     xenstore_buf = (struct xenstore_domain_interface *)(param * PAGE_SIZE);
 
+    xs_req_ring.buf  = xenstore_buf->req;
+    xs_req_ring.size = XENSTORE_RING_SIZE;
+    xs_req_ring.prod = &xenstore_buf->req_prod;
+    xs_req_ring.cons = &xenstore_buf->req_cons;
+
+    xs_rsp_ring.buf  = xenstore_buf->rsp;
+    xs_rsp_ring.size = XENSTORE_RING_SIZE;
+    xs_rsp_ring.prod = &xenstore_buf->rsp_prod;
+    xs_rsp_ring.cons = &xenstore_buf->rsp_cons;
+
     /* Map the ring buffer */
     if(bmc_mem_mapper(xenstore_buf, xenstore_buf, PAGE_SIZE, 2))
     {
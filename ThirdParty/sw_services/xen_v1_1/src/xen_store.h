@@ -19,14 +19,67 @@
 #define _XEN_STORE_H_
 
 /******** Includes ************************************************************/
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "xen/io/xs_wire.h"
+
 
 /******** Definitions *********************************************************/
 typedef unsigned long xenbus_transaction_t;
 
 #define XBT_NIL ((xenbus_transaction_t)0)
 
+/* Requests that can be in flight at once. Blocking calls from tasks wait for
+ * a free slot, asynchronous ones fail. */
+#ifndef XENSTORE_MAX_PENDING
+#define XENSTORE_MAX_PENDING    8
+#endif
+
+/* Watches that can be set at once */
+#ifndef XENSTORE_MAX_WATCHES
+#define XENSTORE_MAX_WATCHES    16
+#endif
+
+/* Values the read cache keeps, each also uses one of the watches */
+#ifndef XENSTORE_CACHE_ENTRIES
+#define XENSTORE_CACHE_ENTRIES  8
+#endif
+
+#define XENSTORE_WAIT_FOREVER   0xFFFFFFFFU
+
+/* One piece of a request payload */
+typedef struct xenstore_seg
+{
+    const void * data;
+    size_t       len;
+} xenstore_seg_t;
+
+/* One key of a xenstore_gather() */
+typedef struct xenstore_gather
+{
+    const char * node;          /* name under the directory */
+    char *       buf;           /* receives the value, NUL terminated */
+    size_t       buf_len;
+    size_t       len;           /* length of the value, or of buf needed */
+    int          err;           /* 0 if the value was read */
+} xenstore_gather_t;
+
+/* Receives a response in the reader task. err is -1 if xenstore answered with
+ * an error, data is NUL terminated and only valid during the call. */
+typedef void (*xenstore_callback_t)(void * arg, int err, char * data, size_t len);
+
+typedef struct xenstore_cache_stats
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t invalidations;     /* cached values dropped because they changed */
+    uint32_t evictions;         /* entries reused for another path */
+} xenstore_cache_stats_t;
+
+/* Called from the watch task with the path that changed and the watch token */
+typedef void (*xenstore_watch_cb_t)(void * arg, const char * path, const char * token);
+
 
 /******** Public Functions ****************************************************/
 int xenstore_transaction_start(xenbus_transaction_t * trans_id);
@@ -35,6 +88,10 @@ int xenstore_transaction_end(xenbus_transaction_t trans_id, int abort,
 
 char * xenstore_read(xenbus_transaction_t trans_id, const char * dir,
     const char * node, size_t * len);
+char * xenstore_read_uncached(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, size_t * len);
+int    xenstore_read_buf(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, size_t * len);
 int    xenstore_read_int(xenbus_transaction_t trans_id, const char * dir,
     const char * node);
 
@@ -42,7 +99,31 @@ int xenstore_write(xenbus_transaction_t trans_id, const char * dir,
     const char * node, const char * value, size_t len);
 int xenstore_printf(xenbus_transaction_t trans_id, const char * dir,
     const char * node, const char* format, ...);
+int xenstore_printf_buf(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, char * buf, size_t buf_len, const char * format, ...);
+
+int xenstore_submit(enum xsd_sockmsg_type type, xenbus_transaction_t trans_id,
+    const xenstore_seg_t * segs, size_t nr_segs, xenstore_callback_t cb,
+    void * arg);
+int xenstore_wait(int handle, char ** data, size_t * len, unsigned int timeout_ms);
+int xenstore_read_async(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, xenstore_callback_t cb, void * arg);
+int xenstore_write_async(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, const char * value, size_t len,
+    xenstore_callback_t cb, void * arg);
+
+char * xenstore_directory(xenbus_transaction_t trans_id, const char * dir,
+    const char * node, unsigned int * num);
+int    xenstore_gather(xenbus_transaction_t trans_id, const char * dir,
+    xenstore_gather_t * keys, size_t nr_keys);
+
+int xenstore_watch(const char * path, xenstore_watch_cb_t cb, void * arg);
+int xenstore_unwatch(int handle);
+
+int  xenstore_cache_enable(int enable);
+void xenstore_cache_get_stats(xenstore_cache_stats_t * stats);
 
 void xenstore_init(void);
+int  xenstore_start_task(unsigned int priority);
 
 #endif /* _XEN_STORE_H_ */
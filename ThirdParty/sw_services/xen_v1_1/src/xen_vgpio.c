@@ -27,6 +27,7 @@
 #include "mm.h"
 #include "xen_events.h"
 #include "xen_gnttab.h"
+#include "xen_ring.h"
 #include "xen_store.h"
 #include "xen_bus.h"
 #include "xen/io/gpioif.h"
@@ -37,6 +38,12 @@
 
 #define MAX_IRQ_REQUESTS 32
 
+/* How long to give the backend to reach InitWait. Some backends only look
+ * at the frontend once it has connected, so connecting goes ahead anyway. */
+#ifndef VGPIO_BACKEND_WAIT_MS
+#define VGPIO_BACKEND_WAIT_MS 1000
+#endif
+
 struct irq_map
 {
     bool in_use;
@@ -46,11 +53,11 @@ struct irq_map
 
 struct vgpio_dev
 {
-    domid_t otherdom;
-
-    char node[256];
+    struct xenbus_device xbdev;
 
     struct xen_gpioif_sring * intf;
+    xen_byte_ring_t req_ring;
+    xen_byte_ring_t rsp_ring;
     grant_ref_t gref;
     evtchn_port_t evtch;
 
@@ -61,7 +68,8 @@ struct vgpio_dev
 
 
 /******** Function Prototypes *************************************************/
-static int talk_to_gpioback(struct vgpio_dev * dev);
+static int talk_to_gpioback(xenbus_transaction_t trans_id, void * arg);
+static int find_frontend(int index, char * node, size_t len);
 
 static void write_req_buf(struct vgpio_dev * dev, const void * data,
     size_t len);
@@ -76,79 +84,40 @@ static int vpgio_frontends = 0;
 
 
 /******** Private Functions ***************************************************/
-static int talk_to_gpioback(struct vgpio_dev * dev)
+/* Publishes the ring to the backend, within the transaction that also moves
+ * the device on to Connected */
+static int talk_to_gpioback(xenbus_transaction_t trans_id, void * arg)
 {
-    xenbus_transaction_t trans_id = XBT_NIL;
-    int again;
+    struct vgpio_dev * dev = arg;
 
-    /* Try until successfully written to xenstore */
-    again = 1;
-    while(again)
+    if(xenstore_printf(trans_id, dev->xbdev.nodename,
+        "grant-ref", "%u", dev->gref) < 0)
     {
-        if(xenstore_transaction_start(&trans_id) != 0)
-        {
-            goto error;
-        }
-
-        if(xenstore_printf(trans_id, dev->node,
-            "grant-ref", "%u", dev->gref) < 0)
-        {
-            goto error;
-        }
-
-        if(xenstore_printf(trans_id, dev->node,
-            "event-channel", "%u", dev->evtch) < 0)
-        {
-            goto error;
-        }
-
-        if(xenstore_transaction_end(trans_id, 0, &again) != 0)
-        {
-            goto error;
-        }
-        trans_id = XBT_NIL;
+        return -1;
     }
 
-    return 0;
-
-error:
-    if(trans_id != XBT_NIL)
+    if(xenstore_printf(trans_id, dev->xbdev.nodename,
+        "event-channel", "%u", dev->evtch) < 0)
     {
-        xenstore_transaction_end(trans_id, 1, &again);
+        return -1;
     }
 
-    return -1;
+    return 0;
 }
 
 static void write_req_buf(struct vgpio_dev * dev, const void * data, size_t len)
 {
-    size_t index;
-    struct xen_gpioif_sring * intf = dev->intf;
-    xen_gpioif_sring_idx cons;
-    xen_gpioif_sring_idx prod;
-
-    prod = intf->req_prod;
-    cons = intf->req_cons;
-    mb();
+    xen_ring_idx_t prod;
+    int            notify;
 
     /* Poll until there is enough space in the ring */
-    while((prod - cons) >= (XEN_GPIOIF_SRING_SIZE - len))
-    {
-        cons = intf->req_cons;
-        mb();
-    }
-
-    /* Can't use memcpy because of ring wraparound */
-    for(index = 0; index < len; index++)
+    while(xen_ring_writable(&dev->req_ring, &prod) < len)
     {
-        intf->req[XEN_GPIOIF_SRING_MASK_IDX(prod)] = ((const char*)data)[index];
-        prod++;
     }
 
-    wmb();
-    intf->req_prod = prod;
-
-    wmb();
+    /* Always wake the backend: gpioback is not known to recheck the ring
+     * before it waits for the next event, so the hint in notify is unused */
+    xen_ring_write(&dev->req_ring, data, len, &notify);
     notify_evtch(dev->evtch);
 
     return;
@@ -156,33 +125,16 @@ static void write_req_buf(struct vgpio_dev * dev, const void * data, size_t len)
 
 static void read_rsp_buf(struct vgpio_dev * dev, void * data, size_t len)
 {
-    size_t index;
-    struct xen_gpioif_sring * intf = dev->intf;
-    xen_gpioif_sring_idx cons;
-    xen_gpioif_sring_idx prod;
-
-    cons = intf->rsp_cons;
-    prod = intf->rsp_prod;
-    mb();
+    xen_ring_idx_t cons;
+    int            notify;
 
     /* Poll until full message in ring */
-    while((prod - cons) < len)
+    while(xen_ring_readable(&dev->rsp_ring, &cons) < len)
     {
-        prod = intf->rsp_prod;
-        mb();
     }
 
-    /* Can't use memcpy because of ring wraparound */
-    for(index = 0; index < len; index++)
-    {
-        ((char *)data)[index] = intf->rsp[XEN_GPIOIF_SRING_MASK_IDX(cons)];
-        cons++;
-    }
-
-    mb();
-    intf->rsp_cons = cons;
-
-    wmb();
+    xen_ring_read(&dev->rsp_ring, data, len, sizeof(struct xen_gpioif_response),
+        &notify);
     notify_evtch(dev->evtch);
 
     return;
@@ -238,32 +190,75 @@ static int send_request(struct vgpio_dev * dev, uint16_t op, uint32_t pin,
     return 0;
 }
 
+/* Finds the node of the index-th vgpio device xenstore lists for this guest,
+ * whatever its number */
+static int find_frontend(int index, char * node, size_t len)
+{
+    char *       names;
+    char *       name;
+    unsigned int num;
+    int          retval = -1;
+
+    names = xenstore_directory(XBT_NIL, "device/vgpio", "", &num);
+    if(names == NULL)
+    {
+        return -1;
+    }
+
+    if(index < (int)num)
+    {
+        /* Skip over the names before it */
+        for(name = names; index > 0; index--)
+        {
+            name += strlen(name) + 1;
+        }
+
+        snprintf(node, len, "device/vgpio/%s", name);
+        retval = 0;
+    }
+
+    free(names);
+
+    return retval;
+}
+
 
 /******** Public Functions ****************************************************/
 
 struct vgpio_dev * vgpio_init(char * nodename)
 {
     struct vgpio_dev * dev = NULL;
+    char               node[XENBUS_PATH_MAX];
+    int                state;
 
     dev = calloc(1, sizeof(struct vgpio_dev));
     if(dev == NULL)
     {
         goto error;
     }
+    dev->gref = INVALID_GREF;
+    dev->xbdev.otherend_watch = -1;
 
     /* Format xenstore path */
     if(nodename == NULL)
     {
-        snprintf(dev->node, sizeof(dev->node), "device/vgpio/%d", vpgio_frontends);
+        if(find_frontend(vpgio_frontends, node, sizeof(node)) != 0)
+        {
+            goto error;
+        }
     }
     else
     {
-        strncpy(dev->node, nodename, sizeof(dev->node));
-        dev->node[sizeof(dev->node) - 1] = '\0'; /* Ensure string is NULL terminated */
+        strncpy(node, nodename, sizeof(node));
+        node[sizeof(node) - 1] = '\0'; /* Ensure string is NULL terminated */
     }
     vpgio_frontends++;
 
-    dev->otherdom = xenstore_read_int(XBT_NIL, dev->node, "backend-id");
+    /* Find the backend, and follow its state from here on */
+    if(xenbus_device_init(&dev->xbdev, node) != 0)
+    {
+        goto error;
+    }
 
     /* Setup shared memory interface with backend */
     dev->intf = valloc(PAGE_SIZE);
@@ -274,25 +269,40 @@ struct vgpio_dev * vgpio_init(char * nodename)
 
     memset(dev->intf, 0, PAGE_SIZE);
 
-    dev->gref = gnttab_grant_access(dev->otherdom, VA_TO_GUEST_PAGE(dev->intf), 0);
+    dev->req_ring.buf  = dev->intf->req;
+    dev->req_ring.size = XEN_GPIOIF_SRING_SIZE;
+    dev->req_ring.prod = &dev->intf->req_prod;
+    dev->req_ring.cons = &dev->intf->req_cons;
+
+    dev->rsp_ring.buf  = dev->intf->rsp;
+    dev->rsp_ring.size = XEN_GPIOIF_SRING_SIZE;
+    dev->rsp_ring.prod = &dev->intf->rsp_prod;
+    dev->rsp_ring.cons = &dev->intf->rsp_cons;
+
+    dev->gref = gnttab_grant_access(dev->xbdev.otherend_id, VA_TO_GUEST_PAGE(dev->intf), 0);
     if(dev->gref == INVALID_GREF)
     {
         goto error;
     }
 
-    if(evtchn_alloc_ubound(dev->otherdom, &dev->evtch) != 0)
+    if(evtchn_alloc_ubound(dev->xbdev.otherend_id, &dev->evtch) != 0)
     {
         goto error;
     }
 
-    /* Write driver paramters to xenstore */
-    if(talk_to_gpioback(dev) != 0)
+    state = xenbus_wait_otherend(&dev->xbdev, XenbusStateInitWait,
+        VGPIO_BACKEND_WAIT_MS);
+    if(state >= XenbusStateClosing)
     {
         goto error;
     }
 
-    /* Let backend know we are ready */
-    xenbus_switch_state(XBT_NIL, dev->node, XenbusStateConnected);
+    /* Write driver paramters to xenstore and let backend know we are ready */
+    if(xenbus_publish(&dev->xbdev, talk_to_gpioback, dev,
+        XenbusStateConnected) != 0)
+    {
+        goto error;
+    }
 
     return dev;
 
@@ -304,6 +314,7 @@ error:
             gnttab_end_access(dev->gref);
         }
 
+        xenbus_device_free(&dev->xbdev);
         free(dev->intf);
         free(dev);
     }
@@ -417,7 +428,7 @@ int vgpio_request_irq(struct vgpio_dev * dev, unsigned gpio,
         return -1;
     }
 
-    if(evtchn_alloc_ubound(dev->otherdom, &evtchn) < 0)
+    if(evtchn_alloc_ubound(dev->xbdev.otherend_id, &evtchn) < 0)
     {
         return -1;
     }
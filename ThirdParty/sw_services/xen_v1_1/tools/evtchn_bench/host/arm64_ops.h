@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host stand-in for arm64_ops.h. The real header supplies the atomics and bit
+ * operations, only what reads AArch64 system registers or issues barriers is
+ * replaced with a host equivalent.
+ */
+#ifndef _HOST_ARM64_OPS_H_
+#define _HOST_ARM64_OPS_H_
+
+#include <sched.h>
+#include <stdint.h>
+
+#include "../../../src/arm64_ops.h"
+
+#undef dsb
+#define dsb(scope)          __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+uint64_t host_read_cntvct(void);
+
+// Everything runs as vCPU 0, whose interrupts the fake Xen thread takes
+#define smp_processor_id()  0U
+
+// The counter is CLOCK_MONOTONIC in nanoseconds
+#define read_cntvct()       host_read_cntvct()
+#define read_cntfrq()       1000000000ULL
+
+// Lets the fake Xen thread run on a host with a single CPU
+#define cpu_relax()         sched_yield()
+
+#endif /* _HOST_ARM64_OPS_H_ */
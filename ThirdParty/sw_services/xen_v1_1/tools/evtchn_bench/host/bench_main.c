@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the event channel ping-pong benchmark against the fake hypervisor.
+ *
+ * Usage: evtchn_bench [iterations] [max_p99_ns]
+ *
+ * Exits non-zero if the benchmark fails or, when max_p99_ns is given, if the
+ * p99 round trip is slower than that, so it can gate changes to the dispatch
+ * path in a host build.
+ */
+
+/******** Includes ************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fake_xen.h"
+#include "xen_events.h"
+#include "xen_events_bench.h"
+
+
+/******** Definitions *********************************************************/
+#define DEFAULT_ITERATIONS  10000
+
+
+/******** Public Functions ****************************************************/
+int main(int argc, char ** argv)
+{
+    evtchn_bench_result_t result;
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    unsigned long long max_p99_ns = 0;
+    unsigned long long p99_ns;
+    int ret;
+
+    if(argc > 1)
+    {
+        iterations = strtoul(argv[1], NULL, 0);
+    }
+    if(argc > 2)
+    {
+        max_p99_ns = strtoull(argv[2], NULL, 0);
+    }
+
+    init_events();
+    fake_xen_start();
+    ret = evtchn_bench_pingpong(iterations, &result);
+    fake_xen_stop();
+
+    if(ret != 0)
+    {
+        fprintf(stderr, "evtchn bench failed\n");
+        return 1;
+    }
+
+    evtchn_bench_print(&result);
+
+    p99_ns = (result.rtt_p99 * 1000000000ULL) / result.counter_hz;
+    if(max_p99_ns != 0 && p99_ns > max_p99_ns)
+    {
+        fprintf(stderr, "p99 round trip %llu ns is above the %llu ns limit\n",
+            p99_ns, max_p99_ns);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A stand-in for the hypervisor, for running xen_events.c on a Linux host.
+ * Hypercalls operate on a local port table and on the shared_info page the
+ * guest registers, the way Xen does for the 2-level ABI. A second thread plays
+ * the event upcall interrupt: whenever a port becomes pending for vCPU 0 it
+ * runs handle_event_irq(), so handlers run concurrently with the guest thread
+ * just as they would in IRQ context on the board. Only loopback channels
+ * (DOMID_SELF) exist; every other operation fails with -ENOSYS.
+ */
+
+/******** Includes ************************************************************/
+#include "fake_xen.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "arm64_ops.h"
+#include "hypercall.h"
+#include "mm.h"
+#include "xen_console.h"
+#include "xen_events.h"
+#include "xen/xen.h"
+#include "xen/event_channel.h"
+#include "xen/memory.h"
+
+
+/******** Definitions *********************************************************/
+#define FAKE_NR_PORTS       64
+
+#define PORT_FREE           0
+#define PORT_UNBOUND        1
+#define PORT_INTERDOMAIN    2
+
+struct fake_port
+{
+    int           state;
+    evtchn_port_t peer;
+};
+
+
+/******** Function Prototypes *************************************************/
+static void raise_upcall(void);
+static void set_pending(evtchn_port_t port);
+static int  port_valid(evtchn_port_t port);
+static int  alloc_port(void);
+static void * xen_thread(void * arg);
+
+
+/******** Module Variables ****************************************************/
+uint64_t ullPortInterruptNesting = 0;
+
+static struct fake_port  fake_ports[FAKE_NR_PORTS];
+static pthread_mutex_t   fake_ports_lock = PTHREAD_MUTEX_INITIALIZER;
+static shared_info_t *   fake_shared_info = NULL;
+
+static pthread_t         fake_xen_thread;
+static pthread_mutex_t   upcall_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    upcall_cond = PTHREAD_COND_INITIALIZER;
+static int               upcall_raised = 0;
+static int               stopping = 0;
+
+
+/******** Private Functions ***************************************************/
+static void raise_upcall(void)
+{
+    pthread_mutex_lock(&upcall_lock);
+    upcall_raised = 1;
+    pthread_cond_signal(&upcall_cond);
+    pthread_mutex_unlock(&upcall_lock);
+}
+
+// As Xen's evtchn_2l_set_pending(), for vCPU 0
+static void set_pending(evtchn_port_t port)
+{
+    shared_info_t * s = fake_shared_info;
+
+    if(synch_test_and_set_bit(port, &s->evtchn_pending[0]))
+    {
+        return;
+    }
+
+    if(!synch_test_bit(port, &s->evtchn_mask[0]) &&
+       !synch_test_and_set_bit(port / (sizeof(xen_ulong_t) * 8), &s->vcpu_info[0].evtchn_pending_sel))
+    {
+        s->vcpu_info[0].evtchn_upcall_pending = 1;
+        raise_upcall();
+    }
+}
+
+static int port_valid(evtchn_port_t port)
+{
+    return port > 0 && port < FAKE_NR_PORTS && fake_ports[port].state != PORT_FREE;
+}
+
+// Port 0 is never handed out, as in Xen
+static int alloc_port(void)
+{
+    int port;
+
+    for(port = 1; port < FAKE_NR_PORTS; port++)
+    {
+        if(fake_ports[port].state == PORT_FREE)
+        {
+            return port;
+        }
+    }
+
+    return -ENOSPC;
+}
+
+static void * xen_thread(void * arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&upcall_lock);
+    while(!stopping)
+    {
+        if(!upcall_raised)
+        {
+            pthread_cond_wait(&upcall_cond, &upcall_lock);
+            continue;
+        }
+        upcall_raised = 0;
+        pthread_mutex_unlock(&upcall_lock);
+
+        ullPortInterruptNesting++;
+        handle_event_irq(NULL);
+        ullPortInterruptNesting--;
+
+        pthread_mutex_lock(&upcall_lock);
+    }
+    pthread_mutex_unlock(&upcall_lock);
+
+    return NULL;
+}
+
+
+/******** Public Functions ****************************************************/
+uint64_t host_read_cntvct(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void printk(const char * fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+int HYPERVISOR_event_channel_op(int cmd, void * param)
+{
+    shared_info_t * s = fake_shared_info;
+    evtchn_port_t port;
+    int ret = 0;
+    int local;
+
+    pthread_mutex_lock(&fake_ports_lock);
+
+    switch(cmd)
+    {
+    case EVTCHNOP_alloc_unbound:
+    {
+        evtchn_alloc_unbound_t * op = param;
+
+        if(op->remote_dom != DOMID_SELF || (local = alloc_port()) < 0)
+        {
+            ret = (op->remote_dom != DOMID_SELF) ? -ENOSYS : local;
+            break;
+        }
+        fake_ports[local].state = PORT_UNBOUND;
+        op->port = local;
+        break;
+    }
+
+    case EVTCHNOP_bind_interdomain:
+    {
+        evtchn_bind_interdomain_t * op = param;
+
+        port = op->remote_port;
+        if(op->remote_dom != DOMID_SELF || !port_valid(port) ||
+           fake_ports[port].state != PORT_UNBOUND)
+        {
+            ret = -EINVAL;
+            break;
+        }
+        if((local = alloc_port()) < 0)
+        {
+            ret = local;
+            break;
+        }
+        fake_ports[local].state = PORT_INTERDOMAIN;
+        fake_ports[local].peer = port;
+        fake_ports[port].state = PORT_INTERDOMAIN;
+        fake_ports[port].peer = local;
+        op->local_port = local;
+        break;
+    }
+
+    case EVTCHNOP_send:
+    {
+        evtchn_send_t * op = param;
+
+        if(!port_valid(op->port))
+        {
+            ret = -EINVAL;
+            break;
+        }
+        if(fake_ports[op->port].state == PORT_INTERDOMAIN)
+        {
+            set_pending(fake_ports[op->port].peer);
+        }
+        break;
+    }
+
+    case EVTCHNOP_close:
+    {
+        evtchn_close_t * op = param;
+
+        if(!port_valid(op->port))
+        {
+            ret = -EINVAL;
+            break;
+        }
+        if(fake_ports[op->port].state == PORT_INTERDOMAIN)
+        {
+            fake_ports[fake_ports[op->port].peer].state = PORT_UNBOUND;
+        }
+        fake_ports[op->port].state = PORT_FREE;
+        synch_clear_bit(op->port, &s->evtchn_pending[0]);
+        synch_set_bit(op->port, &s->evtchn_mask[0]);
+        break;
+    }
+
+    case EVTCHNOP_unmask:
+    {
+        evtchn_unmask_t * op = param;
+
+        if(!port_valid(op->port))
+        {
+            ret = -EINVAL;
+            break;
+        }
+        synch_clear_bit(op->port, &s->evtchn_mask[0]);
+        if(synch_test_bit(op->port, &s->evtchn_pending[0]) &&
+           !synch_test_and_set_bit(op->port / (sizeof(xen_ulong_t) * 8),
+               &s->vcpu_info[0].evtchn_pending_sel))
+        {
+            s->vcpu_info[0].evtchn_upcall_pending = 1;
+            raise_upcall();
+        }
+        break;
+    }
+
+    default:
+        ret = -ENOSYS;
+        break;
+    }
+
+    pthread_mutex_unlock(&fake_ports_lock);
+
+    return ret;
+}
+
+int HYPERVISOR_memory_op(int cmd, void * param)
+{
+    xen_add_to_physmap_t * xatp = param;
+
+    if(cmd != XENMEM_add_to_physmap || xatp->space != XENMAPSPACE_shared_info)
+    {
+        return -ENOSYS;
+    }
+
+    /* The guest passes the page's address as its frame number */
+    fake_shared_info = (shared_info_t *)(uintptr_t)(xatp->gpfn << PAGE_SHIFT);
+
+    return 0;
+}
+
+int HYPERVISOR_console_io(int cmd, int count, char * str)
+{
+    (void)cmd; (void)count; (void)str;
+    return -ENOSYS;
+}
+
+int HYPERVISOR_hvm_op(int cmd, void * param)
+{
+    (void)cmd; (void)param;
+    return -ENOSYS;
+}
+
+int HYPERVISOR_grant_table_op(unsigned int cmd, void * uop, unsigned int count)
+{
+    (void)cmd; (void)uop; (void)count;
+    return -ENOSYS;
+}
+
+int HYPERVISOR_vcpu_op(int cmd, int vcpuid, void * extra_args)
+{
+    (void)cmd; (void)vcpuid; (void)extra_args;
+    return -ENOSYS;
+}
+
+int HYPERVISOR_sched_op(int cmd, void * arg)
+{
+    (void)cmd; (void)arg;
+    return -ENOSYS;
+}
+
+// Starts the thread that delivers event upcalls, after init_events()
+void fake_xen_start(void)
+{
+    stopping = 0;
+    pthread_create(&fake_xen_thread, NULL, xen_thread, NULL);
+}
+
+void fake_xen_stop(void)
+{
+    pthread_mutex_lock(&upcall_lock);
+    stopping = 1;
+    pthread_cond_signal(&upcall_cond);
+    pthread_mutex_unlock(&upcall_lock);
+
+    pthread_join(fake_xen_thread, NULL);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Forced into every host translation unit ahead of anything else. The Xen
+ * public headers pick the x86 interface on a PC host, but the guest code and
+ * the fake hypervisor must agree on the ARM layout of shared_info and the
+ * hypercall arguments, as on the board. Only the architecture test in
+ * xen/xen.h sees the ARM macros; the C library is set up for the host first.
+ */
+#ifndef _XEN_ARM_ABI_H_
+#define _XEN_ARM_ABI_H_
+
+#include <stdint.h>
+
+#pragma push_macro("__x86_64__")
+#pragma push_macro("__i386__")
+#undef __x86_64__
+#undef __i386__
+#define __aarch64__ 1
+
+#include "../../../src/xen/xen.h"
+
+#undef __aarch64__
+#pragma pop_macro("__i386__")
+#pragma pop_macro("__x86_64__")
+
+#endif /* _XEN_ARM_ABI_H_ */
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Event channel ping-pong benchmark. Two local ports are connected to each
+ * other through the hypervisor, so every notify_evtch() is a real
+ * EVTCHNOP_send and every delivery goes through the GIC and handle_event_irq().
+ * It is not part of the library: build it into an application on target, or
+ * run it on a Linux host against a fake hypervisor with the Makefile here.
+ */
+
+/******** Includes ************************************************************/
+#include "xen_events_bench.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "arm64_ops.h"
+#include "xen_console.h"
+#include "xen_events.h"
+#include "xen/xen.h"
+
+
+/******** Definitions *********************************************************/
+/* Give up on a round trip that has not come back in this many seconds */
+#define BENCH_TIMEOUT_SEC       1
+
+/* Spinning needs no relaxing on target, the event arrives as an interrupt */
+#ifndef cpu_relax
+#define cpu_relax()             barrier()
+#endif
+
+struct bench_ctx
+{
+    evtchn_port_t     ping;         // notified by the bench, handler records the time
+    evtchn_port_t     pong;         // echoes every event straight back
+    volatile u64      end;
+    volatile u32      remaining;    // events left to bounce in burst mode
+    volatile u32      done;
+};
+
+
+/******** Function Prototypes *************************************************/
+static void bench_ping_handler(void * data);
+static void bench_pong_handler(void * data);
+static int  bench_wait(struct bench_ctx * ctx, u64 timeout_ticks);
+static int  compare_u64(const void * a, const void * b);
+
+
+/******** Private Functions ***************************************************/
+static void bench_ping_handler(void * data)
+{
+    struct bench_ctx * ctx = data;
+
+    if(ctx->remaining > 0)
+    {
+        ctx->remaining--;
+        notify_evtch(ctx->ping);
+        return;
+    }
+
+    ctx->end = read_cntvct();
+    wmb();
+    ctx->done = 1;
+}
+
+static void bench_pong_handler(void * data)
+{
+    struct bench_ctx * ctx = data;
+
+    notify_evtch(ctx->pong);
+}
+
+static int bench_wait(struct bench_ctx * ctx, u64 timeout_ticks)
+{
+    u64 start = read_cntvct();
+
+    while(!ctx->done)
+    {
+        if((read_cntvct() - start) > timeout_ticks)
+        {
+            return -1;
+        }
+        cpu_relax();
+    }
+    rmb();
+
+    return 0;
+}
+
+static int compare_u64(const void * a, const void * b)
+{
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/******** Public Functions ****************************************************/
+// Measures notify-to-handler round trips over a loopback port pair, then the
+// rate at which the pair can bounce a burst of events between them entirely in
+// IRQ context. Must be called from a task with events initialised.
+int evtchn_bench_pingpong(unsigned int iterations, evtchn_bench_result_t * result)
+{
+    struct bench_ctx ctx;
+    u64 * samples = NULL;
+    u64 timeout;
+    u64 start;
+    unsigned int i;
+    int ret = -1;
+
+    if(iterations == 0 || result == NULL)
+    {
+        return -1;
+    }
+
+    samples = malloc(iterations * sizeof(*samples));
+    if(samples == NULL)
+    {
+        return -1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    memset(result, 0, sizeof(*result));
+    result->iterations = iterations;
+    result->counter_hz = read_cntfrq();
+    timeout = result->counter_hz * BENCH_TIMEOUT_SEC;
+
+    if(evtchn_alloc_ubound(DOMID_SELF, &ctx.ping) < 0)
+    {
+        goto exit;
+    }
+
+    if(evtchn_bind_interdomain(DOMID_SELF, ctx.ping, &ctx.pong) < 0)
+    {
+        unbind_evtchn(ctx.ping);
+        goto exit;
+    }
+
+    if(register_event_handler(ctx.ping, bench_ping_handler, &ctx) < 0 ||
+       register_event_handler(ctx.pong, bench_pong_handler, &ctx) < 0)
+    {
+        goto unbind;
+    }
+    unmask_evtchn(ctx.ping);
+    unmask_evtchn(ctx.pong);
+
+    /* Latency: one event out to the pong port and one back per sample */
+    for(i = 0; i < iterations; i++)
+    {
+        ctx.done = 0;
+        wmb();
+        start = read_cntvct();
+        notify_evtch(ctx.ping);
+        if(bench_wait(&ctx, timeout) < 0)
+        {
+            printk("evtchn bench: round trip %u timed out\r\n", i);
+            goto unbind;
+        }
+        samples[i] = ctx.end - start;
+    }
+
+    qsort(samples, iterations, sizeof(*samples), compare_u64);
+    result->rtt_min = samples[0];
+    result->rtt_p50 = samples[iterations / 2];
+    result->rtt_p99 = samples[((u64)iterations * 99) / 100];
+    result->rtt_max = samples[iterations - 1];
+
+    /* Throughput: the handlers bounce the burst without returning to the task */
+    ctx.done = 0;
+    ctx.remaining = iterations - 1;
+    wmb();
+    start = read_cntvct();
+    notify_evtch(ctx.ping);
+    if(bench_wait(&ctx, timeout * iterations) < 0)
+    {
+        printk("evtchn bench: burst timed out\r\n");
+        goto unbind;
+    }
+    result->burst_ticks = ctx.end - start;
+    if(result->burst_ticks != 0)
+    {
+        /* Each iteration is two deliveries, one on each port */
+        result->events_per_sec = (2ULL * iterations * result->counter_hz) / result->burst_ticks;
+    }
+
+    ret = 0;
+
+unbind:
+    unbind_evtchn(ctx.pong);
+    unbind_evtchn(ctx.ping);
+
+exit:
+    free(samples);
+    return ret;
+}
+
+void evtchn_bench_print(const evtchn_bench_result_t * result)
+{
+    u64 ns_per_tick_x1000 = (1000000000000ULL) / result->counter_hz;
+
+    printk("evtchn ping-pong, %u iterations\r\n", result->iterations);
+    printk("  round trip ns: min %" PRIu64 " p50 %" PRIu64 " p99 %" PRIu64
+        " max %" PRIu64 "\r\n",
+        (result->rtt_min * ns_per_tick_x1000) / 1000,
+        (result->rtt_p50 * ns_per_tick_x1000) / 1000,
+        (result->rtt_p99 * ns_per_tick_x1000) / 1000,
+        (result->rtt_max * ns_per_tick_x1000) / 1000);
+    printk("  burst: %" PRIu64 " events/s\r\n", result->events_per_sec);
+}
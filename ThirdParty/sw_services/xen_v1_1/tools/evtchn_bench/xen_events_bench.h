@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2017, DornerWorks, Ltd.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+ * AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+ * USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _XEN_EVENTS_BENCH_H_
+#define _XEN_EVENTS_BENCH_H_
+
+/******** Includes ************************************************************/
+#include "types.h"
+
+
+/******** Definitions *********************************************************/
+typedef struct evtchn_bench_result
+{
+    u32 iterations;
+    u64 counter_hz;             // CNTVCT frequency the tick values are in
+    u64 rtt_min;                // notify-to-handler round trips, in ticks
+    u64 rtt_p50;
+    u64 rtt_p99;
+    u64 rtt_max;
+    u64 burst_ticks;            // time to bounce the burst between the ports
+    u64 events_per_sec;         // burst events delivered per second
+} evtchn_bench_result_t;
+
+
+/******** Public Functions ****************************************************/
+int  evtchn_bench_pingpong(unsigned int iterations, evtchn_bench_result_t * result);
+void evtchn_bench_print(const evtchn_bench_result_t * result);
+
+
+#endif /* _XEN_EVENTS_BENCH_H_ */
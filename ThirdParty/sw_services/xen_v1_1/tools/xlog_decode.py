@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2017, DornerWorks, Ltd.
+#
+# THIS SOFTWARE IS PROVIDED BY DORNERWORKS FOR USE ON THE CONTRACTED PROJECT,
+# AND ANY EXPRESS OR IMPLIED WARRANTY IS LIMITED TO THIS USE. FOR ALL OTHER
+# USES THIS SOFTWARE IS PROVIDED ''AS IS'' AND ANY EXPRESS OR IMPLIED
+# WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+# EVENT SHALL DORNERWORKS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+# OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+# WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+# OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+
+"""Decode XLOG() binary records in a captured Xen console stream.
+
+Usage: xlog_decode.py [--hz HZ] app.elf [console.log]
+
+Text between records is passed through unchanged. The format strings are read
+from the xen_logfmt section of the guest ELF the log was produced by, and %s
+arguments are looked up in the image's allocated sections.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+XLOG_MAGIC = b'\xfe\xb1'
+XLOG_F_CLOCK = 0x01
+XLOG_MAX_ARGS = 8
+HDR = struct.Struct('<2sBBIQ')
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+CONV = re.compile(r'%([-+ #0]*)(\d+|\*)?(?:\.(\d+|\*))?(hh|h|ll|l|z|j|t)?([diouxXcspn%])')
+
+
+class Image(object):
+    """The allocated sections of a little endian ELF64 file"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 2 or self.data[5] != 1:
+            raise ValueError('%s: not a little endian ELF64 file' % path)
+
+        shoff, = struct.unpack_from('<Q', self.data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', self.data, 0x3a)
+
+        headers = []
+        for i in range(shnum):
+            headers.append(struct.unpack_from('<IIQQQQIIQQ', self.data, shoff + i * shentsize))
+
+        strtab = headers[shstrndx][4]
+        self.sections = {}
+        self.alloc = []
+        for name, stype, flags, addr, offset, size in (h[:6] for h in headers):
+            end = self.data.index(b'\0', strtab + name)
+            sname = self.data[strtab + name:end].decode('ascii')
+            self.sections[sname] = (addr, offset, size)
+            if flags & SHF_ALLOC and stype != SHT_NOBITS and size:
+                self.alloc.append((addr, offset, size))
+
+        if 'xen_logfmt' not in self.sections:
+            raise ValueError('%s: no xen_logfmt section, was it built with XEN_LOG_BINARY?' % path)
+
+    def _cstring(self, offset, limit):
+        end = self.data.find(b'\0', offset, limit)
+        if end < 0:
+            end = limit
+        return self.data[offset:end].decode('utf-8', 'replace')
+
+    def format_string(self, offset):
+        _, base, size = self.sections['xen_logfmt']
+        if offset >= size:
+            return None
+        return self._cstring(base + offset, base + size)
+
+    def string_at(self, addr):
+        for base, offset, size in self.alloc:
+            if base <= addr < base + size:
+                return self._cstring(offset + addr - base, offset + size)
+        return '<%#x>' % addr
+
+
+def signed(value, bits):
+    value &= (1 << bits) - 1
+    if value & (1 << (bits - 1)):
+        value -= 1 << bits
+    return value
+
+
+def width_of(length):
+    if length in ('l', 'll', 'z', 'j', 't'):
+        return 64
+    if length == 'h':
+        return 16
+    if length == 'hh':
+        return 8
+    return 32
+
+
+def render(image, fmt, args):
+    args = list(args)
+
+    def next_arg():
+        return args.pop(0) if args else 0
+
+    def convert(m):
+        flags, width, prec, length, conv = m.groups()
+        if conv == '%':
+            return '%'
+        if width == '*':
+            width = str(signed(next_arg(), 32))
+        if prec == '*':
+            prec = str(signed(next_arg(), 32))
+        spec = '%' + flags + (width or '') + ('.' + prec if prec is not None else '')
+
+        value = next_arg()
+        bits = width_of(length)
+        if conv in 'di':
+            return (spec + 'd') % signed(value, bits)
+        if conv in 'ouxX':
+            return (spec + conv) % (value & ((1 << bits) - 1))
+        if conv == 'c':
+            return (spec + 'c') % chr(value & 0xff)
+        if conv == 'p':
+            return (spec + 's') % ('0x%x' % value)
+        if conv == 's':
+            return (spec + 's') % image.string_at(value)
+        return ''
+
+    return CONV.sub(convert, fmt)
+
+
+def decode(image, stream, out, hz):
+    buf = b''
+    while True:
+        chunk = stream.read(4096)
+        if chunk:
+            buf += chunk
+
+        while buf:
+            start = buf.find(XLOG_MAGIC)
+            if start < 0:
+                # hold back a possible first magic byte for the next chunk
+                keep = 1 if buf.endswith(XLOG_MAGIC[:1]) and chunk else 0
+                out.write(buf[:len(buf) - keep].decode('utf-8', 'replace'))
+                buf = buf[len(buf) - keep:]
+                break
+
+            out.write(buf[:start].decode('utf-8', 'replace'))
+            buf = buf[start:]
+
+            if len(buf) < HDR.size and chunk:
+                break
+            if len(buf) < HDR.size:
+                out.write(buf.decode('utf-8', 'replace'))
+                buf = b''
+                break
+
+            _, nargs, flags, fmt, stamp = HDR.unpack_from(buf)
+            if nargs > XLOG_MAX_ARGS:
+                # not a record after all
+                out.write(buf[:1].decode('utf-8', 'replace'))
+                buf = buf[1:]
+                continue
+
+            size = HDR.size + nargs * 8
+            if len(buf) < size:
+                if chunk:
+                    break
+                out.write(buf.decode('utf-8', 'replace'))
+                buf = b''
+                break
+
+            args = struct.unpack_from('<%dQ' % nargs, buf, HDR.size)
+            buf = buf[size:]
+
+            if flags & XLOG_F_CLOCK:
+                if hz is None and nargs:
+                    hz = args[0]
+                continue
+
+            text = image.format_string(fmt)
+            if text is None:
+                text = '<bad format offset %#x>\n' % fmt
+            else:
+                text = render(image, text, args)
+
+            if hz:
+                out.write('[%12.6f] ' % (float(stamp) / hz))
+            else:
+                out.write('[%16d] ' % stamp)
+            out.write(text)
+
+        if not chunk:
+            break
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode XLOG() binary console records')
+    parser.add_argument('--hz', type=int, default=None,
+                        help='counter frequency, if the log does not carry one')
+    parser.add_argument('elf', help='guest image the log was produced by')
+    parser.add_argument('log', nargs='?', help='captured console output, default stdin')
+    opts = parser.parse_args()
+
+    image = Image(opts.elf)
+    if opts.log:
+        with open(opts.log, 'rb') as stream:
+            decode(image, stream, sys.stdout, opts.hz)
+    else:
+        decode(image, sys.stdin.buffer, sys.stdout, opts.hz)
+
+
+if __name__ == '__main__':
+    main()